@@ -3,17 +3,28 @@
 * @brief Loading and managing images (DataLoader class) - implementation.
 */
 #include "data_loader.h"
+#include "dataset_reader.h"
+#include <mutex>
+#include <limits>
+#include <numeric>
+#include <cstring>
+#include <future>
+#include <sstream>
+#include <chrono>
+#include <algorithm>
  
 
 using namespace std;
 using namespace cv;
 
 DataLoader::DataLoader(string i_path, const int num_categories, ProcessingConfiguration cfg,vector<string>  extensions): 
-path(move(i_path)), num_categories(num_categories), cfg(move(cfg)), allowed_extentions(std::move(extensions)), num_images(0), current_index(0)
+path(move(i_path)), num_categories(num_categories), cfg(move(cfg)), allowed_extentions(std::move(extensions)), num_images(0), current_index(0),
+pca_whitening(no_whitening)
 {
 	if (num_categories < 2) throw invalid_argument("DataLoader constructor: There must be at least 2 categories for classification");
+	if (this->cfg.pca && this->cfg.random_projection > 0) throw invalid_argument("DataLoader constructor: pca and random projection cannot be used together");
 	if (path.back() != '/') path += '/';
-	Image::SetCfg(cfg);
+	Image::SetCfg(this->cfg);
 }
 
 /**
@@ -50,7 +61,21 @@ int DataLoader::ReadData(bool random_shuffle) {
 		num_files += ReadAllFromDirectory(filenames_in_dir, i);
 	}
 
-	if (cfg.pca) pca_vector = PcaCalculate();
+	if (cfg.normalization != no_normalization && !cfg.statistics) CalculateStatistics();
+	else if (cfg.normalization != no_normalization && !images.empty()) {
+		vector<int> channel_sizes;
+		const size_t formatted_size = images.front()->ProcessAndFormatUnnormalized(channel_sizes).size();
+		if (formatted_size != cfg.statistics->mean.size() || channel_sizes != cfg.statistics->channel_sizes) {
+			throw invalid_argument("ReadData: image size does not match the dataset statistics (" + to_string(cfg.statistics->mean.size()) + ")");
+		}
+	}
+	if (cfg.pca && pca_vector.eigenvectors.empty()) pca_vector = PcaCalculate();
+	if (cfg.pca && !images.empty() && images.front()->PcaRow().cols != pca_vector.mean.cols) {
+		throw invalid_argument("ReadData: image size does not match the pca model (" + to_string(pca_vector.mean.cols) + ")");
+	}
+	if (cfg.random_projection > 0 && !images.empty()) {
+		random_projection = make_unique<SparseRandomProjection>(images.front()->PcaRow().cols, cfg.random_projection, cfg.projection_seed);
+	}
 	if (random_shuffle) ShuffleImages();
 	num_images = num_files;
 	return num_files;
@@ -59,7 +84,7 @@ int DataLoader::ReadData(bool random_shuffle) {
 
 std::shared_ptr<std::vector<float>> DataLoader::LoadNextImage()
 {
-	auto current_image = (cfg.pca) ? images[current_index]->ProcesssAndFormatData() : images[current_index]->ProcesssAndFormatData(pca_vector);
+	auto current_image = FormatImage(*images[current_index]);
 	current_index++;
 	if (current_index == num_images)
 	{
@@ -71,71 +96,307 @@ std::shared_ptr<std::vector<float>> DataLoader::LoadNextImage()
 
 
 /**
- * File format:
- * |number of images (int)| number of images x ||number of image points (int)| number of image points x |image point value (float)|| number of images x |image label (int)|
- *
+ * Version 1 files (default) - see WriteVersion1(), version 2 files - see DatasetHeader.
+ * Images are formatted and written in batches of out_cfg.batch_size, so memory does not grow with the number of images.
+ * Records are written through OutputFile (large asynchronous writes, optionally bypassing the file cache),
+ * the achieved write speed is logged. With out_cfg.parallel_write version 2 files are written by the processing threads
+ * at precomputed offsets (see WriteVersion2Parallel()). With more than one shard the images are split into independent files
+ * listed in an index (path + ".index", see WriteShards()), quantization parameters are the same in all the files.
+ * Dataset statistics used for normalization are saved next to the file (path + ".stats").
  */
-void DataLoader::SaveFormattedData(std::string path)
+void DataLoader::SaveFormattedData(std::string path, OutputConfiguration out_cfg)
 {
-	if (cfg.pca) pca_vector = PcaCalculate();
-
-	ofstream file(path, std::ios::out | std::ofstream::binary | ios::trunc);
-
-	file.write(reinterpret_cast<const char *>(&num_images), sizeof(num_images));
+	if (out_cfg.format_version != 1 && out_cfg.format_version != dataset_file::format_version) {
+		throw invalid_argument("SaveFormattedData: unknown file format version " + to_string(out_cfg.format_version));
+	}
+	if (out_cfg.parallel_write && out_cfg.direct_io) {
+		throw invalid_argument("SaveFormattedData: parallel writes cannot bypass the file cache (records are not sector aligned)");
+	}
+	if (out_cfg.parallel_write && out_cfg.format_version == 1) {
+		throw invalid_argument("SaveFormattedData: parallel writes require file format version 2");
+	}
+	const auto shards = AssignShards(out_cfg);
+	if (cfg.pca && pca_vector.eigenvectors.empty()) pca_vector = PcaCalculate();
 
-	shared_ptr<vector<float>> formatted_vector;
+	QuantizationParameters quantization;
+	if (dataset_file::IsQuantized(out_cfg.dtype)) quantization = CalibrateQuantization(out_cfg);
 
 	cout << "Processing data" << endl;
+	if (shards.size() == 1) WriteDatasetFile(path, out_cfg, quantization);
+	else WriteShards(path, shards, out_cfg, quantization);
 
-	for (auto& img : images) {
+	if (cfg.normalization != no_normalization && cfg.statistics) cfg.statistics->Save(path + ".stats");
+}
 
-		if (cfg.pca)  formatted_vector = img->ProcesssAndFormatData(pca_vector);
-		else formatted_vector = img->ProcesssAndFormatData();
+/**
+ * Number of shards is given directly or follows from the shard size. Contiguous assignment gives consecutive images to
+ * consecutive shards. Balanced assignment deals images sorted by category to the shards in turn, so every category is
+ * split evenly (counts differ by at most one) and shard sizes differ by at most one; images keep their order within a shard.
+ */
+vector<vector<int>> DataLoader::AssignShards(const OutputConfiguration& out_cfg) const
+{
+	const int count = static_cast<int>(images.size());
+	if (out_cfg.shards < 1 || out_cfg.shard_size < 0) throw invalid_argument("SaveFormattedData: number of shards must be positive");
+	if (out_cfg.shards > 1 && out_cfg.shard_size > 0) throw invalid_argument("SaveFormattedData: number of shards and shard size cannot be used together");
+	const int num_shards = (out_cfg.shard_size > 0) ? max(1, (count + out_cfg.shard_size - 1) / out_cfg.shard_size) : out_cfg.shards;
+	if (num_shards > max(count, 1)) throw invalid_argument("SaveFormattedData: more shards (" + to_string(num_shards) + ") than images");
+
+	vector<vector<int>> shards(num_shards);
+	if (!out_cfg.balanced_shards) {
+		const int64_t shard_size = (out_cfg.shard_size > 0) ? out_cfg.shard_size : 0;
+		for (int s = 0; s < num_shards; s++) {
+			const int begin = static_cast<int>(shard_size ? s * shard_size : static_cast<int64_t>(count) * s / num_shards);
+			const int end = static_cast<int>(shard_size ? min<int64_t>(count, begin + shard_size) : static_cast<int64_t>(count) * (s + 1) / num_shards);
+			for (int i = begin; i < end; i++) shards[s].push_back(i);
+		}
+		return shards;
+	}
 
-		int size = static_cast<int>(formatted_vector->size());
-		file.write(reinterpret_cast<const char *>(&size), sizeof(size));
+	vector<int> order(count);
+	iota(order.begin(), order.end(), 0);
+	stable_sort(order.begin(), order.end(), [this](int a, int b) { return images[a]->GetLabel() < images[b]->GetLabel(); });
+	for (int k = 0; k < count; k++) shards[k % num_shards].push_back(order[k]);
+	for (auto& shard : shards) sort(shard.begin(), shard.end());
+	return shards;
+}
 
-		for (float item : *formatted_vector) {
-			file.write(reinterpret_cast<const char *>(&item), sizeof(float));
+/**
+ * Every shard is a complete dataset file (written as a single file would be), the images of a shard temporarily
+ * replace all the images of the loader while it is written. The index is written after all the shards.
+ */
+void DataLoader::WriteShards(const string& path, const vector<vector<int>>& shards, const OutputConfiguration& out_cfg,
+	const QuantizationParameters& quantization)
+{
+	vector<unique_ptr<Image>> all_images = move(images);
+	const int all_num_images = num_images;
+	const auto restore = [&](size_t s) {
+		for (size_t k = 0; k < images.size(); k++) all_images[shards[s][k]] = move(images[k]);
+		images = move(all_images);
+		num_images = all_num_images;
+	};
+
+	vector<ShardInfo> index;
+	for (size_t s = 0; s < shards.size(); s++) {
+		images.clear();
+		for (int i : shards[s]) images.push_back(move(all_images[i]));
+		num_images = static_cast<int>(images.size());
+		const string shard_path = dataset_file::ShardPath(path, static_cast<int>(s), static_cast<int>(shards.size()));
+		cout << "Shard " << s + 1 << " of " << shards.size() << ": " << shard_path << " (" << num_images << " images)" << endl;
+		try {
+			WriteDatasetFile(shard_path, out_cfg, quantization);
+		}
+		catch (...) {
+			restore(s);
+			throw;
 		}
+		for (size_t k = 0; k < images.size(); k++) all_images[shards[s][k]] = move(images[k]);
+		index.push_back({ shard_path, num_images });
 	}
-	for (auto& img : images) {
-		int label = img->GetLabel();
-		file.write(reinterpret_cast<const char*>(&label), sizeof(label));
+	images = move(all_images);
+	num_images = all_num_images;
+
+	dataset_file::WriteShardIndex(path + ".index", index);
+}
+
+/**
+ * Version 2 files are written in parallel at precomputed offsets if chosen, otherwise through OutputFile.
+ */
+void DataLoader::WriteDatasetFile(const string& path, const OutputConfiguration& out_cfg, const QuantizationParameters& quantization)
+{
+	if (out_cfg.parallel_write) {
+		WriteVersion2Parallel(path, out_cfg, quantization);
+		return;
 	}
+	OutputFile file(path, out_cfg.direct_io);
+	if (out_cfg.format_version == 1) WriteVersion1(file, out_cfg, quantization);
+	else WriteVersion2(file, out_cfg, quantization);
 
-	file.close();
+	file.Close();
+	cout << "Saved " << file.GetPosition() / (1024.0 * 1024.0) << " MB, writing took " << file.GetSeconds() << " s (" << file.GetThroughput()
+		<< " MB/s, waiting for the disk " << file.GetWaitSeconds() << " s)" << endl;
 }
 
 /**
-* File format:
-* |number of images (int)| number of images x ||number of image points (int)| number of image points x |image point value (float)|| number of images x |image label (int)|
-*
-*/
-void DataLoader::ReadVector(std::string path, std::vector<std::vector<float>>& data_vector, vector<int>& labels)
+ * File format:
+ * |number of images (int)| number of images x ||number of image points (int)| number of image points x |image point value (float)|| number of images x |image label (int)|
+ * For data types other than float32 the file starts with an extended header and values are stored in the data type:
+ * |extended header marker -1 (int)|data type (int)|(uint8/int8 only) quantization parameters|number of images (int)| ... (as above)
+ */
+void DataLoader::WriteVersion1(OutputFile& file, const OutputConfiguration& out_cfg, const QuantizationParameters& quantization)
+{
+	if (out_cfg.dtype != float32) {
+		const int32_t dtype = out_cfg.dtype;
+		file.Write(&dataset_file::extended_header_marker, sizeof(dataset_file::extended_header_marker));
+		file.Write(&dtype, sizeof(dtype));
+		if (dataset_file::IsQuantized(out_cfg.dtype)) WriteQuantization(file, quantization);
+	}
+	file.Write(&num_images, sizeof(num_images));
+
+	vector<char> buffer;
+	const size_t element_size = dataset_file::ElementSize(out_cfg.dtype);
+	ForEachFormattedBatch(out_cfg.batch_size, [&](int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			const auto formatted_vector = FormatImage(*images[i]);
+			const int size = static_cast<int>(formatted_vector->size());
+			file.Write(&size, sizeof(size));
+			const void* encoded = dataset_file::EncodeRecord(formatted_vector->data(), size, out_cfg.dtype, quantization, buffer);
+			file.Write(encoded, size * element_size);
+		}
+	});
+	vector<int32_t> labels;
+	for (auto& img : images) labels.push_back(img->GetLabel());
+	file.Write(labels.data(), labels.size() * sizeof(int32_t));
+}
+
+/**
+ * Labels are known before the images are processed, so they are written before the records.
+ * Offsets of the records are collected while writing, the offsets table is written only if the records have different sizes,
+ * then the header is rewritten with the final values.
+ */
+void DataLoader::WriteVersion2(OutputFile& file, const OutputConfiguration& out_cfg, const QuantizationParameters& quantization)
 {
-	ifstream file(path, std::ios::in | std::ifstream::binary);
+	DatasetHeader header = Version2Header(out_cfg);
+	file.Write(&header, sizeof(header));
 
-	int size = 0;
-	file.read(reinterpret_cast<char *>(&size), sizeof(size));
+	if (dataset_file::IsQuantized(out_cfg.dtype)) {
+		header.quantization_offset = file.Pad(dataset_file::alignment);
+		WriteQuantization(file, quantization);
+	}
 
-	data_vector.resize(size);
-	labels.resize(size);
-	for (int i = 0; i < size; i++) {
-		int size2 = 0;
-		file.read(reinterpret_cast<char *>(&size2), sizeof(size2));
-		float f;
-		for (int k = 0; k < size2; k++) {
-			file.read(reinterpret_cast<char *>(&f), sizeof(float));
-			data_vector[i].push_back(f);
+	vector<int32_t> labels;
+	for (auto& img : images) labels.push_back(img->GetLabel());
+	header.labels_offset = file.Pad(dataset_file::alignment);
+	file.Write(labels.data(), labels.size() * sizeof(int32_t));
+
+	header.data_offset = file.Pad(dataset_file::alignment);
+	vector<int64_t> offsets = { 0 };
+	vector<char> buffer;
+	const size_t element_size = dataset_file::ElementSize(out_cfg.dtype);
+	bool same_size = true;
+	ForEachFormattedBatch(out_cfg.batch_size, [&](int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			const auto formatted_vector = FormatImage(*images[i]);
+			const size_t size = formatted_vector->size();
+			const void* encoded = dataset_file::EncodeRecord(formatted_vector->data(), size, out_cfg.dtype, quantization, buffer);
+			file.Write(encoded, size * element_size);
+			if (offsets.size() == 1) header.record_size = static_cast<int32_t>(size);
+			same_size = same_size && static_cast<int32_t>(size) == header.record_size;
+			offsets.push_back(offsets.back() + static_cast<int64_t>(size * element_size));
 		}
+	});
+
+	if (!same_size) {
+		header.record_size = 0;
+		header.offsets_offset = file.Pad(dataset_file::alignment);
+		file.Write(offsets.data(), offsets.size() * sizeof(int64_t));
 	}
-	for (int i = 0; i < size; i++) {
-		int label = 0;
-		file.read(reinterpret_cast<char *>(&label), sizeof(label));
-		labels[i] = label;
+	file.Rewrite(0, &header, sizeof(header));
+}
+
+/**
+ * All the images have the same size, so the formatted size of the first image gives the record size and the offset of
+ * every record (the same layout as written by WriteVersion2(), the file is identical byte for byte).
+ * Header, quantization parameters and labels are written first. Every batch is formatted in parallel and the sizes of its records
+ * are checked (a runtime error is thrown before any of its records is written), then every thread encodes its images and writes
+ * each record at its final offset - records are written out of order, without a reorder buffer or a writer thread.
+ * Formatted data is released after writing (unless batch_size is 0).
+ */
+void DataLoader::WriteVersion2Parallel(const string& path, const OutputConfiguration& out_cfg, const QuantizationParameters& quantization)
+{
+	const auto start = chrono::steady_clock::now();
+	const int count = static_cast<int>(images.size());
+	const size_t element_size = dataset_file::ElementSize(out_cfg.dtype);
+
+	DatasetHeader header = Version2Header(out_cfg);
+	header.record_size = (count > 0) ? static_cast<int32_t>(FormatImage(*images.front())->size()) : 0;
+	const int64_t record_bytes = header.record_size * static_cast<int64_t>(element_size);
+
+	ostringstream quantization_stream;
+	if (dataset_file::IsQuantized(out_cfg.dtype)) dataset_file::WriteQuantization(quantization_stream, quantization);
+	const string quantization_bytes = quantization_stream.str();
+	int64_t offset = sizeof(DatasetHeader);
+	if (!quantization_bytes.empty()) {
+		header.quantization_offset = dataset_file::Align(offset);
+		offset = header.quantization_offset + static_cast<int64_t>(quantization_bytes.size());
+	}
+	header.labels_offset = dataset_file::Align(offset);
+	header.data_offset = dataset_file::Align(header.labels_offset + count * static_cast<int64_t>(sizeof(int32_t)));
+
+	vector<int32_t> labels;
+	for (auto& img : images) labels.push_back(img->GetLabel());
+
+	PositionalFile file(path, header.data_offset + count * record_bytes);
+	file.WriteAt(0, &header, sizeof(header));
+	file.WriteAt(header.quantization_offset, quantization_bytes.data(), quantization_bytes.size());
+	file.WriteAt(header.labels_offset, labels.data(), labels.size() * sizeof(int32_t));
+
+	const int batch_size = (out_cfg.batch_size > 0) ? out_cfg.batch_size : max(count, 1);
+	for (int begin = 0; begin < count; begin += batch_size) {
+		const int end = min(count, begin + batch_size);
+		FormatBatch(begin, end);
+		for (int i = begin; i < end; i++) {
+			if (FormatImage(*images[i])->size() != static_cast<size_t>(header.record_size)) {
+				throw runtime_error("SaveFormattedData: parallel writes require records of the same size");
+			}
+		}
+		preprocessing::ParallelFor(Range(begin, end), [&](const Range& range) {
+			vector<char> buffer;
+			for (int i = range.start; i < range.end; i++) {
+				const auto formatted_vector = FormatImage(*images[i]);
+				const void* encoded = dataset_file::EncodeRecord(formatted_vector->data(), formatted_vector->size(), out_cfg.dtype, quantization, buffer);
+				file.WriteAt(header.data_offset + i * record_bytes, encoded, static_cast<size_t>(record_bytes));
+				if (out_cfg.batch_size > 0) images[i]->ReleaseFormatted();
+			}
+		});
+	}
+	file.Close();
+
+	const double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	const double megabytes = file.GetSize() / (1024.0 * 1024.0);
+	cout << "Saved " << megabytes << " MB in " << seconds << " s (" << ((seconds > 0) ? megabytes / seconds : 0) << " MB/s)" << endl;
+}
+
+/**
+ * Offsets and record size are filled in while writing.
+ */
+DatasetHeader DataLoader::Version2Header(const OutputConfiguration& out_cfg) const
+{
+	DatasetHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, dataset_file::dataset_magic, sizeof(header.magic));
+	header.version = dataset_file::format_version;
+	header.num_records = static_cast<int64_t>(images.size());
+	header.dtype = out_cfg.dtype;
+	header.layout = (cfg.pca || random_projection) ? 0 : cfg.layout;
+	header.label_type = dataset_file::label_int32;
+	return header;
+}
+
+/**
+ * Parameters are serialized with dataset_file::WriteQuantization() and appended as one block.
+ */
+void DataLoader::WriteQuantization(OutputFile& file, const QuantizationParameters& quantization)
+{
+	ostringstream stream;
+	dataset_file::WriteQuantization(stream, quantization);
+	const string bytes = stream.str();
+	file.Write(bytes.data(), bytes.size());
+}
+
+/**
+* File format: version 2 (see DatasetHeader) or version 1 (see WriteVersion1()), read with DatasetReader.
+* Files with other data types than float32 are converted (or dequantized) to floats while reading.
+*/
+void DataLoader::ReadVector(std::string path, std::vector<std::vector<float>>& data_vector, vector<int>& labels)
+{
+	DatasetReader reader(path, true);
+	const size_t num_records = static_cast<size_t>(reader.GetNumRecords());
+	data_vector.resize(num_records);
+	labels.assign(reader.GetLabels(), reader.GetLabels() + num_records);
+	for (size_t i = 0; i < num_records; i++) {
+		data_vector[i].resize(reader.GetRecordSize(i));
+		reader.DecodeRecord(i, data_vector[i].data());
 	}
-	file.close();
 }
 
 /**
@@ -217,18 +478,257 @@ int DataLoader::ReadAllFromDirectory(vector<string>& filenames, int label) {
 }
 
 
+/**
+ * Throws an invalid argument error if the model is whitened differently than chosen in cfg.
+ */
+void DataLoader::LoadPcaModel(const string& path)
+{
+	auto model_file = make_unique<MappedFile>(path);
+	pca_vector = pca_engine::LoadModel(*model_file, &pca_whitening);
+	pca_model_file = move(model_file);
+
+	const PcaWhitening whitening = cfg.pca_options.whitening;
+	if (whitening != no_whitening && pca_whitening == no_whitening) {
+		pca_vector = pca_engine::Whiten(pca_vector, whitening, cfg.pca_options.whitening_epsilon);
+		pca_whitening = whitening;
+	}
+	else if (whitening != no_whitening && whitening != pca_whitening) {
+		throw invalid_argument("LoadPcaModel: pca model is saved with a different whitening: " + path);
+	}
+}
+
+void DataLoader::SavePcaModel(const string& path) const
+{
+	pca_engine::SaveModel(path, pca_vector, pca_whitening, cfg.pca_options.whitening_epsilon);
+}
+
 void DataLoader::ShuffleImages()
 {
 	shuffle(images.begin(), images.end(), default_random_engine());
 }
 
+/**
+ * Images are streamed through the pca engine (rows are processed on demand in every pass),
+ * so the data matrix (number of images x image size) is never built.
+ * With fit_samples set the pca is fitted on a (uniform or stratified) sample of the images and the variance captured on
+ * images held out from the fit (a tenth of the sample) is logged - close to the variance captured on the sample when
+ * the sample is big enough. Chosen solver, the reason for the choice and time of every phase are logged.
+ * Whitening (if chosen) is folded into the returned model, so projecting the images stays one matrix product per batch.
+ */
 PCA DataLoader::PcaCalculate()
 {
-	Mat m;
-	for (auto& img : images) m.push_back(*img->PcaPrepare());
+	cout << "Calculating pca" << endl;
+	const int num_rows = static_cast<int>(images.size());
+	const PcaOptions& options = cfg.pca_options;
+	vector<int> order(num_rows);
+	iota(order.begin(), order.end(), 0);
+	int num_fit = num_rows;
+	if (options.fit_samples > 0 && options.fit_samples < num_rows) {
+		vector<int> labels;
+		for (auto& img : images) labels.push_back(img->GetLabel());
+		order = pca_engine::SampleRows(labels, options.fit_samples, options.stratified, options.seed);
+		num_fit = options.fit_samples;
+	}
+
+	vector<int> plane_sizes;
+	images[order[0]]->PcaRow(&plane_sizes);
+	const auto sample_rows = [&](int i) { return images[order[i]]->PcaRow(); };
+	PcaReport report;
+	PCA pca = (options.input == pca_per_plane && plane_sizes.size() > 1) ?
+		pca_engine::FitPerPlane(num_fit, sample_rows, plane_sizes, options, &report) :
+		pca_engine::Fit(num_fit, sample_rows, options, &report);
+
+	cout << "Pca solver: " << pca_engine::SolverName(report.solver) << " (" << report.reason << ")" << endl;
+	for (auto& phase : report.phase_seconds) cout << "  " << phase.first << ": " << phase.second << " s" << endl;
+	cout << "Pca components: " << pca.eigenvectors.rows << ", captured variance: " << report.captured_variance << endl;
+
+	if (num_fit < num_rows) {
+		const int num_held_out = min(num_rows - num_fit, max(1, num_fit / 10));
+		const double held_out_variance = pca_engine::CapturedVariance(pca, num_held_out,
+			[&](int i) { return images[order[num_fit + i]]->PcaRow(); });
+		cout << "Pca fitted on " << num_fit << " of " << num_rows << " images, captured variance on "
+			<< num_held_out << " held-out images: " << held_out_variance << endl;
+	}
+
+	if (options.whitening != no_whitening) {
+		pca = pca_engine::Whiten(pca, options.whitening, options.whitening_epsilon);
+		pca_whitening = options.whitening;
+	}
+	return pca;
+}
+
+/**
+ * Every thread accumulates statistics of its part of the images, partial results are merged at the end.
+ * Images are processed without caching the formatted data.
+ */
+void DataLoader::CalculateStatistics()
+{
+	cout << "Calculating dataset statistics" << endl;
+
+	unique_ptr<StatisticsAccumulator> total;
+	mutex total_mutex;
+
+	preprocessing::ParallelFor(Range(0, static_cast<int>(images.size())), [&](const Range& range) {
+		unique_ptr<StatisticsAccumulator> partial;
+		vector<int> channel_sizes;
+		for (int i = range.start; i < range.end; i++) {
+			const auto sample = images[i]->ProcessAndFormatUnnormalized(channel_sizes);
+			if (!partial) partial = make_unique<StatisticsAccumulator>(channel_sizes, formatting::IsInterleaved(cfg.layout, channel_sizes.size()));
+			partial->Add(sample);
+		}
+		if (!partial) return;
+
+		lock_guard<mutex> lock(total_mutex);
+		if (total) total->Merge(*partial);
+		else total = move(partial);
+	}, getNumThreads());
+
+	if (!total) return;
+	cfg.statistics = make_shared<DatasetStatistics>(total->Finish());
+	Image::SetCfg(cfg);
+}
+
+/**
+ * Eigenvectors are read from memory once per batch instead of once per image (matrix product instead of
+ * a matrix-vector product for every image). Batches are smaller for small ranges, so every thread gets a batch.
+ */
+void DataLoader::ProjectImages(int begin_image, int end_image)
+{
+	const int num_images_to_project = end_image - begin_image;
+	const int threads = max(1, getNumThreads());
+	const int batch_size = min(256, max(16, (num_images_to_project + threads - 1) / threads));
+	const int num_batches = (num_images_to_project + batch_size - 1) / batch_size;
+
+	const int dim = random_projection ? random_projection->GetDim() : pca_vector.mean.cols;
+
+	preprocessing::ParallelFor(Range(0, num_batches), [&](const Range& range) {
+		Mat batch, projections;
+		for (int b = range.start; b < range.end; b++) {
+			const int begin = begin_image + b * batch_size;
+			const int end = min(end_image, begin + batch_size);
+			batch.create(end - begin, dim, CV_32F);
+			for (int i = begin; i < end; i++) {
+				Mat batch_row = batch.row(i - begin);
+				images[i]->PcaRow().convertTo(batch_row, CV_32F);
+			}
+			if (random_projection) random_projection->Project(batch, projections);
+			else pca_engine::Project(pca_vector, batch, projections);
+			for (int i = begin; i < end; i++) images[i]->FormatProjection(projections.row(i - begin));
+		}
+	});
+}
 
-	return preprocessing::PcaBase(m, 100);
+void DataLoader::FormatBatch(int begin, int end)
+{
+	if (cfg.pca || random_projection) {
+		ProjectImages(begin, end);
+		return;
+	}
+	preprocessing::ParallelFor(Range(begin, end), [&](const Range& range) {
+		for (int i = range.start; i < range.end; i++) FormatImage(*images[i]);
+	});
 }
 
+/**
+ * The next batch is formatted (in parallel) while the function consumes the current one, so writing does not wait for
+ * processing and processing does not wait for writing. Batches are consumed in order, at most two batches are formatted at once.
+ */
+void DataLoader::ForEachFormattedBatch(int batch_size, const function<void(int, int)>& consume)
+{
+	const int count = static_cast<int>(images.size());
+	if (batch_size <= 0) {
+		FormatBatch(0, count);
+		consume(0, count);
+		return;
+	}
 
+	future<void> next = async(launch::async, [this, count, batch_size]() { FormatBatch(0, min(count, batch_size)); });
+	for (int begin = 0; begin < count; begin += batch_size) {
+		const int end = min(count, begin + batch_size);
+		next.get();
+		if (end < count) next = async(launch::async, [this, count, batch_size, end]() { FormatBatch(end, min(count, end + batch_size)); });
+		consume(begin, end);
+		for (int i = begin; i < end; i++) images[i]->ReleaseFormatted();
+	}
+	if (next.valid()) next.get();
+}
+
+/**
+ * Images not projected in a batch are projected one by one (random projection).
+ */
+shared_ptr<vector<float>> DataLoader::FormatImage(Image& img)
+{
+	if (random_projection && !img.IsFormatted()) {
+		Mat row, projection;
+		img.PcaRow().convertTo(row, CV_32F);
+		random_projection->Project(row, projection);
+		img.FormatProjection(projection);
+	}
+	return (cfg.pca) ? img.ProcesssAndFormatData(pca_vector) : img.ProcesssAndFormatData();
+}
 
+/**
+ * Formatted 8-bit pixels (no pca, normalization, fixed point, native depth or operations producing floats) are multiples of 1/256,
+ * they are represented exactly with scale 1/256 and no calibration pass is needed.
+ * Otherwise minimum and maximum of every channel are found in a parallel pass over all the images
+ * (formatted data is cached in the images and reused when saving, unless it is released after every batch).
+ */
+QuantizationParameters DataLoader::CalibrateQuantization(const OutputConfiguration& out_cfg)
+{
+	if (images.empty()) throw runtime_error("SaveFormattedData: no images to calibrate the quantization on");
+	QuantizationParameters parameters;
+	FormatImage(*images.front());
+	const auto channel_sizes = images.front()->GetChannelSizes();
+	const bool per_channel = out_cfg.per_channel_quantization && channel_sizes.size() > 1;
+	const size_t num_channels = per_channel ? channel_sizes.size() : 1;
+	parameters.interleaved = per_channel && formatting::IsInterleaved(cfg.layout, channel_sizes.size());
+	if (per_channel) parameters.channel_sizes = channel_sizes;
+	else parameters.channel_sizes = { accumulate(channel_sizes.begin(), channel_sizes.end(), 0) };
+	parameters.scale.resize(num_channels);
+	parameters.zero_point.resize(num_channels);
+
+	const bool exact_8bit = !cfg.pca && !random_projection && cfg.normalization == no_normalization && !cfg.standardize && cfg.lcn_window <= 0 && !cfg.fixed_point && !cfg.native_depth;
+	if (exact_8bit) {
+		for (size_t c = 0; c < num_channels; c++) {
+			dataset_file::CalculateQuantization(0, 255.0 / 256, out_cfg.dtype, parameters.scale[c], parameters.zero_point[c]);
+		}
+		return parameters;
+	}
+
+	cout << "Calibrating quantization" << endl;
+
+	vector<double> min_values(num_channels, (numeric_limits<double>::max)());
+	vector<double> max_values(num_channels, (numeric_limits<double>::lowest)());
+	mutex range_mutex;
+
+	ForEachFormattedBatch(out_cfg.batch_size, [&](int begin, int end) {
+		preprocessing::ParallelFor(Range(begin, end), [&](const Range& range) {
+			vector<double> local_min(num_channels, (numeric_limits<double>::max)());
+			vector<double> local_max(num_channels, (numeric_limits<double>::lowest)());
+			for (int i = range.start; i < range.end; i++) {
+				const auto data = FormatImage(*images[i]);
+				size_t offset = 0;
+				for (size_t c = 0; c < num_channels; c++) {
+					const int channel_size = parameters.channel_sizes[c];
+					const size_t start = parameters.interleaved ? c : offset;
+					const size_t stride = parameters.interleaved ? num_channels : 1;
+					for (size_t k = 0, j = start; k < static_cast<size_t>(channel_size); k++, j += stride) {
+						local_min[c] = min(local_min[c], static_cast<double>((*data)[j]));
+						local_max[c] = max(local_max[c], static_cast<double>((*data)[j]));
+					}
+					offset += channel_size;
+				}
+			}
+			lock_guard<mutex> lock(range_mutex);
+			for (size_t c = 0; c < num_channels; c++) {
+				min_values[c] = min(min_values[c], local_min[c]);
+				max_values[c] = max(max_values[c], local_max[c]);
+			}
+		}, getNumThreads());
+	});
+
+	for (size_t c = 0; c < num_channels; c++) {
+		dataset_file::CalculateQuantization(min_values[c], max_values[c], out_cfg.dtype, parameters.scale[c], parameters.zero_point[c]);
+	}
+	return parameters;
+}
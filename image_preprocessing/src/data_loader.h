@@ -7,9 +7,16 @@
 #define DATA_LOADER_H
 
 #include "image.h"
+#include "dataset_file.h"
+#include "pca_engine.h"
+#include "random_projection.h"
+#include "mapped_file.h"
+#include "output_file.h"
+#include "positional_file.h"
 #include<string>
 #include <Windows.h>
 #include <random>
+#include <functional>
 #include<fstream>
 
 /**
@@ -45,10 +52,25 @@ public:
 	std::shared_ptr<std::vector<float>> LoadNextImage();
 
 	/**
-	 * @brief Saving all the processed and formatted images to a file.
+	 * @brief Saving all the processed and formatted images to a file (or to shard files listed in path + ".index").
+	 * Dataset statistics (when normalization is chosen) are saved next to it, in path + ".stats".
 	 * @param path path where the file should be saved
+	 * @param out_cfg OutputConfiguration struct containing saving options
 	 */
-	void SaveFormattedData(std::string path);
+	void SaveFormattedData(std::string path, OutputConfiguration out_cfg = OutputConfiguration());
+
+	/**
+	 * @brief Loading a pca model saved with SavePcaModel() - pca is not calculated when the data is read.
+	 * Model saved without whitening is whitened if whitening is chosen in cfg.
+	 * @param path path to the model file (mapped for the lifetime of the loader)
+	 */
+	void LoadPcaModel(const std::string& path);
+
+	/**
+	 * @brief Saving the pca model (calculated or loaded) to a file.
+	 * @param path path where the file should be saved
+	 */
+	void SavePcaModel(const std::string& path) const;
 
 	int GetNumImages() const { return num_images; }
 	
@@ -69,6 +91,9 @@ private:
 	int num_images; /**< Number of images read */
 	int current_index; /**< Current index of image - for loading images one by one */
 	cv::PCA pca_vector; /**< Pca parameters for whole vector of images */
+	PcaWhitening pca_whitening; /**< Whitening applied to pca_vector (eigenvectors replaced with the whitening matrix) */
+	std::unique_ptr<SparseRandomProjection> random_projection; /**< Sparse random projection used instead of pca (nullptr if not chosen in cfg) */
+	std::unique_ptr<MappedFile> pca_model_file; /**< Mapped pca model file (pca_vector points to its memory when the model is loaded) */
 
 	/**
 	 * @brief Searching for files with allowed extensions in a folder.
@@ -94,6 +119,107 @@ private:
 	*/
 	cv::PCA PcaCalculate();
 
+	/**
+	* @brief Projecting images onto the pca components (or with the random projection) in batches (one matrix product
+	* per batch, batches processed in parallel) and setting the projections as their formatted data.
+	* @param begin index of the first image
+	* @param end index after the last image
+	*/
+	void ProjectImages(int begin, int end);
+
+	/**
+	* @brief Formatting a range of images in parallel (formatted data is cached in the images).
+	* @param begin index of the first image
+	* @param end index after the last image
+	*/
+	void FormatBatch(int begin, int end);
+
+	/**
+	* @brief Formatting all the images batch by batch and passing the batches in order to a function (e.g. writing them).
+	* Formatted data of a batch is released after the function returns, unless batch_size is 0.
+	* @param batch_size number of images in a batch (0 - all the images in one batch, formatted data stays cached)
+	* @param consume function called with the range [begin, end) of every formatted batch
+	*/
+	void ForEachFormattedBatch(int batch_size, const std::function<void(int, int)>& consume);
+
+	/**
+	* @brief Processing and formatting an image (with pca, if chosen in cfg).
+	*/
+	std::shared_ptr<std::vector<float>> FormatImage(Image& img);
+
+	/**
+	* @brief Calculate quantization parameters of formatted data for quantized data types (range of values found in a parallel pass).
+	* @param out_cfg output configuration (data type and per channel quantization flag)
+	*/
+	QuantizationParameters CalibrateQuantization(const OutputConfiguration& out_cfg);
+
+	/**
+	* @brief Assigning images to the shards of the output.
+	* @param out_cfg output configuration (number or size of shards, balanced assignment flag)
+	* @returns indices of the images of every shard (one shard with all the images if the output is not sharded)
+	*/
+	std::vector<std::vector<int>> AssignShards(const OutputConfiguration& out_cfg) const;
+
+	/**
+	* @brief Writing every shard of the images to its own dataset file and writing the shard index (path + ".index").
+	* @param path path of the whole dataset (shard paths are made with dataset_file::ShardPath())
+	* @param shards indices of the images of every shard
+	* @param out_cfg output configuration
+	* @param quantization quantization parameters (uint8/int8 data types)
+	*/
+	void WriteShards(const std::string& path, const std::vector<std::vector<int>>& shards, const OutputConfiguration& out_cfg,
+		const QuantizationParameters& quantization);
+
+	/**
+	* @brief Writing all the images to a dataset file in the version and way chosen in out_cfg.
+	* @param path path to the output file
+	* @param out_cfg output configuration
+	* @param quantization quantization parameters (uint8/int8 data types)
+	*/
+	void WriteDatasetFile(const std::string& path, const OutputConfiguration& out_cfg, const QuantizationParameters& quantization);
+
+	/**
+	* @brief Writing formatted images in the version 1 file format (stream of records, labels at the end).
+	* @param file output file
+	* @param out_cfg output configuration
+	* @param quantization quantization parameters (uint8/int8 data types)
+	*/
+	void WriteVersion1(OutputFile& file, const OutputConfiguration& out_cfg, const QuantizationParameters& quantization);
+
+	/**
+	* @brief Writing formatted images in the version 2 file format (header, aligned labels and records).
+	* @param file output file
+	* @param out_cfg output configuration
+	* @param quantization quantization parameters (uint8/int8 data types)
+	*/
+	void WriteVersion2(OutputFile& file, const OutputConfiguration& out_cfg, const QuantizationParameters& quantization);
+
+	/**
+	* @brief Writing formatted images in the version 2 file format from the processing threads, every record at its precomputed offset.
+	* @param path path to the output file
+	* @param out_cfg output configuration
+	* @param quantization quantization parameters (uint8/int8 data types)
+	*/
+	void WriteVersion2Parallel(const std::string& path, const OutputConfiguration& out_cfg, const QuantizationParameters& quantization);
+
+	/**
+	* @brief Header of a version 2 file with the fields known before writing (offsets and record size are 0).
+	* @param out_cfg output configuration
+	*/
+	DatasetHeader Version2Header(const OutputConfiguration& out_cfg) const;
+
+	/**
+	* @brief Appending quantization parameters to the output file.
+	* @param file output file
+	* @param quantization quantization parameters
+	*/
+	static void WriteQuantization(OutputFile& file, const QuantizationParameters& quantization);
+
+	/**
+	* @brief Calculate dataset statistics for normalization (one parallel pass over all the images) and set them in cfg.
+	*/
+	void CalculateStatistics();
+
 
 };
 
@@ -0,0 +1,402 @@
+/**
+* @file dataset_file.cpp
+* @brief Dataset file format - implementation of data type conversions.
+*/
+
+#include "dataset_file.h"
+#include <opencv2/core/core.hpp>
+#include <opencv2/core/hal/intrin.hpp>
+#include <cstring>
+#include <stdexcept>
+#include <algorithm>
+#include <fstream>
+#include <cstdio>
+
+using namespace std;
+using namespace cv;
+
+/**
+ * dtype - float32
+ * per_channel_quantization - false
+ * format_version - 1
+ * direct_io - false
+ * parallel_write - false
+ * shards - 1
+ * shard_size - 0
+ * balanced_shards - false
+ * batch_size - 1024
+ */
+OutputConfiguration::OutputConfiguration() : dtype(float32), per_channel_quantization(false), format_version(1),
+	direct_io(false), parallel_write(false), shards(1), shard_size(0), balanced_shards(false), batch_size(1024)
+{
+}
+
+namespace
+{
+	/**
+	 * Channel sizes have to cover the record exactly, otherwise a channel would be converted past the end of the buffers.
+	 */
+	void CheckChannelSizes(const QuantizationParameters& parameters, size_t n, const string& function)
+	{
+		const size_t num_channels = parameters.channel_sizes.size();
+		if (num_channels == 0 || parameters.scale.size() != num_channels || parameters.zero_point.size() != num_channels) {
+			throw invalid_argument(function + ": invalid quantization parameters");
+		}
+		size_t total = 0;
+		for (auto channel_size : parameters.channel_sizes) {
+			if (channel_size <= 0) throw invalid_argument(function + ": invalid quantization parameters");
+			total += static_cast<size_t>(channel_size);
+		}
+		if (total != n) throw invalid_argument(function + ": record size does not match the channel sizes");
+	}
+
+	/**
+	 * Per-value parameters of interleaved channels: entry k belongs to channel k % num_channels, 16 entries past the
+	 * channel count, so 16 consecutive values starting at any channel read their parameters at offset j % num_channels.
+	 */
+	template <typename T>
+	vector<T> InterleavedPattern(const vector<T>& values)
+	{
+		vector<T> pattern(values.size() + 16);
+		for (size_t k = 0; k < pattern.size(); k++) pattern[k] = values[k % values.size()];
+		return pattern;
+	}
+}
+
+namespace dataset_file
+{
+	size_t ElementSize(DataType dtype)
+	{
+		switch (dtype) {
+		case float32: return sizeof(float);
+		case float16:
+		case bfloat16: return sizeof(uint16_t);
+		case uint8:
+		case int8: return sizeof(uint8_t);
+		default: throw invalid_argument("ElementSize: unknown data type");
+		}
+	}
+
+	bool IsVersion2(const void* data, size_t size)
+	{
+		if (size < sizeof(DatasetHeader)) return false;
+		const DatasetHeader* header = static_cast<const DatasetHeader*>(data);
+		return memcmp(header->magic, dataset_magic, sizeof(dataset_magic)) == 0;
+	}
+
+	const void* EncodeRecord(const float* src, size_t n, DataType dtype, const QuantizationParameters& parameters, vector<char>& buffer)
+	{
+		if (dtype == float32) return src;
+		buffer.resize(n * ElementSize(dtype));
+		if (IsQuantized(dtype)) Quantize(src, buffer.data(), n, dtype, parameters);
+		else ConvertFromFloat(src, buffer.data(), n, dtype);
+		return buffer.data();
+	}
+
+	void DecodeRecord(const void* src, float* dst, size_t n, DataType dtype, const QuantizationParameters& parameters)
+	{
+		if (IsQuantized(dtype)) Dequantize(src, dst, n, dtype, parameters);
+		else ConvertToFloat(src, dst, n, dtype);
+	}
+
+	/**
+	 * NaN is mapped to quiet NaN, so rounding cannot turn it into infinity.
+	 */
+	uint16_t FloatToBfloat16(float value)
+	{
+		uint32_t bits;
+		memcpy(&bits, &value, sizeof(bits));
+		if (value != value) return 0x7FC0;
+		bits += 0x7FFF + ((bits >> 16) & 1);
+		return static_cast<uint16_t>(bits >> 16);
+	}
+
+	float Bfloat16ToFloat(uint16_t value)
+	{
+		const uint32_t bits = static_cast<uint32_t>(value) << 16;
+		float result;
+		memcpy(&result, &bits, sizeof(result));
+		return result;
+	}
+
+	/**
+	 * float16 conversion uses cv::convertFp16 (F16C instructions when available),
+	 * bfloat16 rounding is vectorized with OpenCV universal intrinsics, 8 values per iteration.
+	 */
+	void ConvertFromFloat(const float* src, void* dst, size_t n, DataType dtype)
+	{
+		if (n == 0) return;
+		if (dtype == float32) memcpy(dst, src, n * sizeof(float));
+		else if (dtype == float16) {
+			Mat src_mat(1, static_cast<int>(n), CV_32F, const_cast<float*>(src));
+			Mat dst_mat(1, static_cast<int>(n), CV_16S, dst);
+			convertFp16(src_mat, dst_mat);
+		}
+		else if (dtype == bfloat16) {
+			uint16_t* out = static_cast<uint16_t*>(dst);
+			size_t j = 0;
+#if CV_SIMD128
+			const v_uint32x4 v_bias = v_setall_u32(0x7FFF);
+			const v_uint32x4 v_one = v_setall_u32(1);
+			const v_uint32x4 v_nan = v_setall_u32(0x7FC0);
+			for (; j + 8 <= n; j += 8) {
+				v_uint32x4 v_rounded[2];
+				for (int k = 0; k < 2; k++) {
+					const v_float32x4 v_value = v_load(src + j + 4 * k);
+					const v_uint32x4 v_bits = v_reinterpret_as_u32(v_value);
+					const v_uint32x4 v_result = (v_bits + v_bias + ((v_bits >> 16) & v_one)) >> 16;
+					v_rounded[k] = v_select(v_reinterpret_as_u32(v_value != v_value), v_nan, v_result);
+				}
+				v_store(out + j, v_pack(v_rounded[0], v_rounded[1]));
+			}
+#endif
+			for (; j < n; j++) out[j] = FloatToBfloat16(src[j]);
+		}
+		else throw invalid_argument("ConvertFromFloat: unknown data type");
+	}
+
+	void ConvertToFloat(const void* src, float* dst, size_t n, DataType dtype)
+	{
+		if (n == 0) return;
+		if (dtype == float32) memcpy(dst, src, n * sizeof(float));
+		else if (dtype == float16) {
+			Mat src_mat(1, static_cast<int>(n), CV_16S, const_cast<void*>(src));
+			Mat dst_mat(1, static_cast<int>(n), CV_32F, dst);
+			convertFp16(src_mat, dst_mat);
+		}
+		else if (dtype == bfloat16) {
+			const uint16_t* in = static_cast<const uint16_t*>(src);
+			for (size_t j = 0; j < n; j++) dst[j] = Bfloat16ToFloat(in[j]);
+		}
+		else throw invalid_argument("ConvertToFloat: unknown data type");
+	}
+
+	/**
+	 * Range is extended to contain 0, so that 0 is represented exactly. Empty range gives scale 1.
+	 */
+	void CalculateQuantization(double min_value, double max_value, DataType dtype, float& scale, int32_t& zero_point)
+	{
+		if (!IsQuantized(dtype)) throw invalid_argument("CalculateQuantization: data type is not quantized");
+		const double q_min = (dtype == uint8) ? 0 : -128;
+		const double q_max = (dtype == uint8) ? 255 : 127;
+
+		min_value = min(min_value, 0.0);
+		max_value = max(max_value, 0.0);
+		const double range_scale = (max_value - min_value) / (q_max - q_min);
+		scale = static_cast<float>(range_scale > 0 ? range_scale : 1.0);
+		zero_point = static_cast<int32_t>(min(q_max, max(q_min, static_cast<double>(cvRound(q_min - min_value / scale)))));
+	}
+
+	/**
+	 * Segments of consecutive channels are converted with cv::Mat::convertTo (vectorized, rounding and saturation).
+	 * Interleaved channels multiply by precomputed 1 / scale of every value's channel, vectorized with OpenCV universal
+	 * intrinsics, 16 values per iteration (rounding to nearest and saturation as in convertTo).
+	 * Channel sizes are checked against the record size before anything is converted.
+	 */
+	void Quantize(const float* src, void* dst, size_t n, DataType dtype, const QuantizationParameters& parameters)
+	{
+		if (!IsQuantized(dtype)) throw invalid_argument("Quantize: data type is not quantized");
+		CheckChannelSizes(parameters, n, "Quantize");
+		const int depth = (dtype == uint8) ? CV_8U : CV_8S;
+		const size_t num_channels = parameters.channel_sizes.size();
+
+		if (parameters.interleaved && num_channels > 1) {
+			vector<float> inverse_scale(num_channels);
+			for (size_t c = 0; c < num_channels; c++) inverse_scale[c] = 1.f / parameters.scale[c];
+			const vector<float> scale_pattern = InterleavedPattern(inverse_scale);
+			const vector<int32_t> zero_pattern = InterleavedPattern(parameters.zero_point);
+			uint8_t* out = static_cast<uint8_t*>(dst);
+			size_t i = 0;
+#if CV_SIMD128
+			for (; i + 16 <= n; i += 16) {
+				const size_t p = i % num_channels;
+				v_int32x4 v_value[4];
+				for (int k = 0; k < 4; k++) {
+					v_value[k] = v_round(v_load(src + i + 4 * k) * v_load(scale_pattern.data() + p + 4 * k)) +
+						v_load(zero_pattern.data() + p + 4 * k);
+				}
+				const v_int16x8 v_low = v_pack(v_value[0], v_value[1]);
+				const v_int16x8 v_high = v_pack(v_value[2], v_value[3]);
+				if (dtype == uint8) v_store(out + i, v_pack_u(v_low, v_high));
+				else v_store(reinterpret_cast<schar*>(out) + i, v_pack(v_low, v_high));
+			}
+#endif
+			for (; i < n; i++) {
+				const size_t c = i % num_channels;
+				const int value = cvRound(src[i] * inverse_scale[c]) + parameters.zero_point[c];
+				out[i] = (dtype == uint8) ? saturate_cast<uchar>(value) : static_cast<uint8_t>(saturate_cast<schar>(value));
+			}
+			return;
+		}
+
+		size_t offset = 0;
+		for (size_t c = 0; c < num_channels; c++) {
+			const int channel_size = parameters.channel_sizes[c];
+			Mat src_mat(1, channel_size, CV_32F, const_cast<float*>(src + offset));
+			Mat dst_mat(1, channel_size, depth, static_cast<uint8_t*>(dst) + offset);
+			src_mat.convertTo(dst_mat, depth, 1.0 / parameters.scale[c], parameters.zero_point[c]);
+			offset += channel_size;
+		}
+	}
+
+	/**
+	 * Counterpart of Quantize(): (value - zero point) * scale, interleaved channels vectorized 16 values per iteration.
+	 */
+	void Dequantize(const void* src, float* dst, size_t n, DataType dtype, const QuantizationParameters& parameters)
+	{
+		if (!IsQuantized(dtype)) throw invalid_argument("Dequantize: data type is not quantized");
+		CheckChannelSizes(parameters, n, "Dequantize");
+		const int depth = (dtype == uint8) ? CV_8U : CV_8S;
+		const size_t num_channels = parameters.channel_sizes.size();
+
+		if (parameters.interleaved && num_channels > 1) {
+			const vector<float> scale_pattern = InterleavedPattern(parameters.scale);
+			const vector<int32_t> zero_pattern = InterleavedPattern(parameters.zero_point);
+			size_t i = 0;
+#if CV_SIMD128
+			for (; i + 16 <= n; i += 16) {
+				const size_t p = i % num_channels;
+				v_int32x4 v_value[4];
+				if (dtype == uint8) {
+					v_uint16x8 v_low, v_high;
+					v_expand(v_load(static_cast<const uchar*>(src) + i), v_low, v_high);
+					v_uint32x4 v_wide[4];
+					v_expand(v_low, v_wide[0], v_wide[1]);
+					v_expand(v_high, v_wide[2], v_wide[3]);
+					for (int k = 0; k < 4; k++) v_value[k] = v_reinterpret_as_s32(v_wide[k]);
+				}
+				else {
+					v_int16x8 v_low, v_high;
+					v_expand(v_load(static_cast<const schar*>(src) + i), v_low, v_high);
+					v_expand(v_low, v_value[0], v_value[1]);
+					v_expand(v_high, v_value[2], v_value[3]);
+				}
+				for (int k = 0; k < 4; k++) {
+					v_store(dst + i + 4 * k, v_cvt_f32(v_value[k] - v_load(zero_pattern.data() + p + 4 * k)) *
+						v_load(scale_pattern.data() + p + 4 * k));
+				}
+			}
+#endif
+			for (; i < n; i++) {
+				const size_t c = i % num_channels;
+				const int value = (dtype == uint8) ? static_cast<const uint8_t*>(src)[i] : static_cast<const int8_t*>(src)[i];
+				dst[i] = (value - parameters.zero_point[c]) * parameters.scale[c];
+			}
+			return;
+		}
+
+		size_t offset = 0;
+		for (size_t c = 0; c < num_channels; c++) {
+			const int channel_size = parameters.channel_sizes[c];
+			Mat src_mat(1, channel_size, depth, const_cast<uint8_t*>(static_cast<const uint8_t*>(src) + offset));
+			Mat dst_mat(1, channel_size, CV_32F, dst + offset);
+			src_mat.convertTo(dst_mat, CV_32F, parameters.scale[c], -parameters.zero_point[c] * static_cast<double>(parameters.scale[c]));
+			offset += channel_size;
+		}
+	}
+
+	/**
+	 * Format:
+	 * |number of channels (int)|interleaved (int)| number of channels x |channel size (int)|scale (float)|zero point (int)||
+	 */
+	void WriteQuantization(ostream& file, const QuantizationParameters& parameters)
+	{
+		const int32_t num_channels = static_cast<int32_t>(parameters.channel_sizes.size());
+		const int32_t interleaved = parameters.interleaved ? 1 : 0;
+		file.write(reinterpret_cast<const char*>(&num_channels), sizeof(num_channels));
+		file.write(reinterpret_cast<const char*>(&interleaved), sizeof(interleaved));
+		for (int32_t c = 0; c < num_channels; c++) {
+			const int32_t channel_size = parameters.channel_sizes[c];
+			file.write(reinterpret_cast<const char*>(&channel_size), sizeof(channel_size));
+			file.write(reinterpret_cast<const char*>(&parameters.scale[c]), sizeof(float));
+			file.write(reinterpret_cast<const char*>(&parameters.zero_point[c]), sizeof(int32_t));
+		}
+	}
+
+	/**
+	 * Channels are appended as they are read (nothing is allocated for a channel count the stream does not contain).
+	 * Throws an invalid argument error for a non-positive number of channels or channel size and for a truncated stream.
+	 */
+	QuantizationParameters ReadQuantization(istream& file)
+	{
+		QuantizationParameters parameters;
+		int32_t num_channels = 0;
+		int32_t interleaved = 0;
+		file.read(reinterpret_cast<char*>(&num_channels), sizeof(num_channels));
+		file.read(reinterpret_cast<char*>(&interleaved), sizeof(interleaved));
+		if (!file || num_channels <= 0) throw invalid_argument("ReadQuantization: invalid quantization header");
+		parameters.interleaved = interleaved != 0;
+		for (int32_t c = 0; c < num_channels; c++) {
+			int32_t channel_size = 0, zero_point = 0;
+			float scale = 0;
+			file.read(reinterpret_cast<char*>(&channel_size), sizeof(channel_size));
+			file.read(reinterpret_cast<char*>(&scale), sizeof(scale));
+			file.read(reinterpret_cast<char*>(&zero_point), sizeof(zero_point));
+			if (!file) throw invalid_argument("ReadQuantization: quantization parameters are truncated");
+			if (channel_size <= 0) throw invalid_argument("ReadQuantization: invalid channel size");
+			parameters.channel_sizes.push_back(channel_size);
+			parameters.scale.push_back(scale);
+			parameters.zero_point.push_back(zero_point);
+		}
+		return parameters;
+	}
+
+	/**
+	 * Extension is the part of the file name after its last dot.
+	 */
+	string ShardPath(const string& path, int shard, int num_shards)
+	{
+		const size_t separator = path.find_last_of("/\\");
+		const size_t dot = path.find_last_of('.');
+		const size_t split = (dot != string::npos && (separator == string::npos || dot > separator)) ? dot : path.size();
+		char suffix[32];
+		snprintf(suffix, sizeof(suffix), "-%05d-of-%05d", shard, num_shards);
+		return path.substr(0, split) + suffix + path.substr(split);
+	}
+
+	void WriteShardIndex(const string& path, const vector<ShardInfo>& shards)
+	{
+		ofstream file(path);
+		if (!file) throw invalid_argument("WriteShardIndex: file could not be opened: " + path);
+		int64_t num_records = 0;
+		for (auto& shard : shards) num_records += shard.num_records;
+		file << "shards " << shards.size() << " records " << num_records << endl;
+		for (auto& shard : shards) {
+			const size_t separator = shard.path.find_last_of("/\\");
+			file << shard.path.substr(separator == string::npos ? 0 : separator + 1) << " " << shard.num_records << endl;
+		}
+		if (!file) throw runtime_error("WriteShardIndex: writing the file failed: " + path);
+	}
+
+	/**
+	 * Throws an invalid argument error when the file cannot be opened or is not a shard index.
+	 * Shards are read until the end of the file (nothing is allocated from the header counts),
+	 * their number and the sum of their records are then checked against the header.
+	 */
+	vector<ShardInfo> ReadShardIndex(const string& path)
+	{
+		ifstream file(path);
+		if (!file) throw invalid_argument("ReadShardIndex: file could not be opened: " + path);
+		string shards_key, records_key;
+		size_t num_shards = 0;
+		int64_t num_records = 0;
+		file >> shards_key >> num_shards >> records_key >> num_records;
+		if (!file || shards_key != "shards" || records_key != "records") throw invalid_argument("ReadShardIndex: not a shard index: " + path);
+
+		const size_t separator = path.find_last_of("/\\");
+		const string directory = (separator == string::npos) ? "" : path.substr(0, separator + 1);
+		vector<ShardInfo> shards;
+		int64_t shard_records = 0;
+		ShardInfo shard;
+		while (file >> shard.path >> shard.num_records) {
+			if (shard.num_records < 0) throw invalid_argument("ReadShardIndex: shard index is corrupted: " + path);
+			shard_records += shard.num_records;
+			shard.path = directory + shard.path;
+			shards.push_back(shard);
+		}
+		if (!file.eof() || shards.size() != num_shards || shard_records != num_records) {
+			throw invalid_argument("ReadShardIndex: shard index is truncated or corrupted: " + path);
+		}
+		return shards;
+	}
+}
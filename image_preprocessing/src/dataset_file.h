@@ -0,0 +1,253 @@
+/**
+* @file dataset_file.h
+* @brief Dataset file format - output data types and conversions of formatted data.
+*/
+
+#ifndef DATASET_FILE_H
+#define DATASET_FILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <string>
+#include <istream>
+#include <ostream>
+
+/**
+ *  Enum for available data types of saved formatted data.
+ *  Default char values for easier commandline arguments parsing.
+ */
+enum DataType {
+	float32 = 'f',
+	float16 = 'h',
+	bfloat16 = 'b',
+	uint8 = 'u', /**< quantized, with scale and zero point */
+	int8 = 'i' /**< quantized, with scale and zero point */
+};
+
+/**
+ * @brief Struct representing output configuration - how processed data is saved.
+ */
+struct OutputConfiguration {
+
+	/**
+	 * @brief Default OutputConfiguration constructor.
+	 */
+	OutputConfiguration();
+
+	DataType dtype; /**< Data type of saved values */
+	bool per_channel_quantization; /**< Flag for separate scale and zero point for every channel (uint8/int8 data types) */
+	int format_version; /**< Version of the file format (1 - original stream format, default; 2 - aligned format with header) */
+	bool direct_io; /**< Flag for writing the file without the system file cache (unbuffered writes) */
+	bool parallel_write; /**< Flag for writing records from the processing threads at precomputed offsets (version 2, records of the same size) */
+	int shards; /**< Number of files the images are split into (1 - single file, see dataset_file::WriteShardIndex()) */
+	int shard_size; /**< Number of images in a file (0 - given by shards), the number of files follows from the number of images */
+	bool balanced_shards; /**< Flag for assigning images of every category evenly to all the files (otherwise consecutive images form a file) */
+	int batch_size; /**< Number of images formatted and written at once, released after writing (0 - all the images, formatted data stays cached) */
+};
+
+/**
+ * @brief Struct representing quantization parameters of saved data: value = (quantized - zero_point) * scale.
+ * Channels are consecutive segments of a record or are interleaved (as in DatasetStatistics).
+ */
+struct QuantizationParameters {
+	std::vector<int> channel_sizes; /**< Number of values in each channel */
+	bool interleaved; /**< Flag for interleaved channels */
+	std::vector<float> scale; /**< Scale of each channel */
+	std::vector<int32_t> zero_point; /**< Zero point of each channel */
+};
+
+/**
+ * @brief Struct representing a file of a sharded dataset listed in the shard index.
+ */
+struct ShardInfo {
+	std::string path; /**< Path to the dataset file of the shard */
+	int64_t num_records; /**< Number of records in the shard */
+};
+
+/**
+ * @brief Header of a version 2 dataset file (64 bytes), offsets are counted from the beginning of the file and are multiples of 64.
+ * File: |header|quantization parameters (optional)|labels|records|record offsets (optional)|
+ * Records of the same size form one contiguous tensor (num_records x record_size values), so a record is found in O(1);
+ * records of different sizes (record_size 0) are found with the offsets table.
+ */
+struct DatasetHeader {
+	char magic[4]; /**< dataset_file::dataset_magic */
+	int32_t version; /**< Format version (2) */
+	int64_t num_records; /**< Number of records (images) */
+	int32_t record_size; /**< Number of values in every record (0 - records of different sizes, see offsets_offset) */
+	int32_t dtype; /**< DataType of the values */
+	int32_t layout; /**< OutputLayout of the records (0 - projections, no image layout) */
+	int32_t label_type; /**< Type of the labels (dataset_file::label_int32) */
+	int64_t data_offset; /**< Records (values of consecutive records without gaps) */
+	int64_t labels_offset; /**< Labels (num_records values of label_type) */
+	int64_t offsets_offset; /**< Byte offsets of the records relative to data_offset (num_records + 1 int64 values, 0 - not present) */
+	int64_t quantization_offset; /**< Quantization parameters written with WriteQuantization() (0 - not quantized) */
+};
+static_assert(sizeof(DatasetHeader) == 64, "dataset header must have 64 bytes");
+
+namespace dataset_file
+{
+	/**
+	 * Value of the first int in files with extended header (number of images in the original format is never negative).
+	 */
+	const int32_t extended_header_marker = -1;
+
+	/**
+	 * Magic of version 2 files (read as the number of images in the original format it would be over 10^9 images).
+	 */
+	const char dataset_magic[4] = { 'P', 'P', 'D', 'S' };
+
+	/**
+	 * Current version of the file format.
+	 */
+	const int32_t format_version = 2;
+
+	/**
+	 * Alignment of the arrays in version 2 files (bytes).
+	 */
+	const int64_t alignment = 64;
+
+	/**
+	 * Label type of version 2 files - 32-bit signed integer.
+	 */
+	const int32_t label_int32 = 'i';
+
+	/**
+	 * @brief Rounding an offset up to a multiple of the alignment.
+	 */
+	inline int64_t Align(int64_t offset) { return (offset + alignment - 1) / alignment * alignment; }
+
+	/**
+	 * @brief Checking if the file begins with the header of a version 2 file.
+	 * @param data pointer to the beginning of the file
+	 * @param size number of bytes available
+	 */
+	bool IsVersion2(const void* data, size_t size);
+
+	/**
+	 * @brief Encoding a record of formatted data in given data type.
+	 * @param src pointer to input floats
+	 * @param n number of values
+	 * @param dtype output data type
+	 * @param parameters quantization parameters (uint8/int8 only)
+	 * @param buffer buffer for converted values
+	 * @returns pointer to the encoded values (src for float32, buffer otherwise)
+	 */
+	const void* EncodeRecord(const float* src, size_t n, DataType dtype, const QuantizationParameters& parameters, std::vector<char>& buffer);
+
+	/**
+	 * @brief Decoding a record saved in given data type to floats.
+	 * @param src pointer to the encoded values
+	 * @param dst pointer to output floats
+	 * @param n number of values
+	 * @param dtype data type of the values
+	 * @param parameters quantization parameters (uint8/int8 only)
+	 */
+	void DecodeRecord(const void* src, float* dst, size_t n, DataType dtype, const QuantizationParameters& parameters);
+
+	/**
+	 * @brief Size of a single value of given data type in bytes.
+	 */
+	size_t ElementSize(DataType dtype);
+
+	/**
+	 * @brief Converting floats to given data type.
+	 * @param src pointer to input floats
+	 * @param dst pointer to output buffer (n * ElementSize(dtype) bytes)
+	 * @param n number of values
+	 * @param dtype output data type
+	 */
+	void ConvertFromFloat(const float* src, void* dst, size_t n, DataType dtype);
+
+	/**
+	 * @brief Converting values of given data type to floats.
+	 * @param src pointer to input buffer (n * ElementSize(dtype) bytes)
+	 * @param dst pointer to output floats
+	 * @param n number of values
+	 * @param dtype input data type
+	 */
+	void ConvertToFloat(const void* src, float* dst, size_t n, DataType dtype);
+
+	/**
+	 * @brief Checking if the data type is quantized (uint8/int8).
+	 */
+	inline bool IsQuantized(DataType dtype) { return dtype == uint8 || dtype == int8; }
+
+	/**
+	 * @brief Calculating quantization parameters of a channel from the range of its values.
+	 * @param min_value minimum value in the channel
+	 * @param max_value maximum value in the channel
+	 * @param dtype quantized data type (uint8/int8)
+	 * @param scale calculated scale
+	 * @param zero_point calculated zero point
+	 */
+	void CalculateQuantization(double min_value, double max_value, DataType dtype, float& scale, int32_t& zero_point);
+
+	/**
+	 * @brief Quantizing a record of formatted data.
+	 * @param src pointer to input floats
+	 * @param dst pointer to output buffer (n bytes)
+	 * @param n number of values (sum of channel sizes)
+	 * @param dtype quantized data type (uint8/int8)
+	 * @param parameters quantization parameters
+	 */
+	void Quantize(const float* src, void* dst, size_t n, DataType dtype, const QuantizationParameters& parameters);
+
+	/**
+	 * @brief Dequantizing a record of saved data.
+	 * @param src pointer to input buffer (n bytes)
+	 * @param dst pointer to output floats
+	 * @param n number of values (sum of channel sizes)
+	 * @param dtype quantized data type (uint8/int8)
+	 * @param parameters quantization parameters
+	 */
+	void Dequantize(const void* src, float* dst, size_t n, DataType dtype, const QuantizationParameters& parameters);
+
+	/**
+	 * @brief Writing quantization parameters to a binary stream.
+	 */
+	void WriteQuantization(std::ostream& file, const QuantizationParameters& parameters);
+
+	/**
+	 * @brief Reading quantization parameters written with WriteQuantization().
+	 */
+	QuantizationParameters ReadQuantization(std::istream& file);
+
+	/**
+	 * @brief Path of a shard of a dataset: index and number of shards are inserted before the extension
+	 * (e.g. data.bin, shard 3 of 8 - data-00003-of-00008.bin).
+	 * @param path path of the whole dataset
+	 * @param shard index of the shard
+	 * @param num_shards number of shards
+	 */
+	std::string ShardPath(const std::string& path, int shard, int num_shards);
+
+	/**
+	 * @brief Writing the index of a sharded dataset (text file).
+	 * Format: first line "shards <number of shards> records <number of records>", then a line "<file name> <number of records>"
+	 * for every shard, file names are relative to the directory of the index.
+	 * @param path path to the index file
+	 * @param shards shards of the dataset (only file names of the paths are written)
+	 */
+	void WriteShardIndex(const std::string& path, const std::vector<ShardInfo>& shards);
+
+	/**
+	 * @brief Reading the index of a sharded dataset written with WriteShardIndex().
+	 * @param path path to the index file
+	 * @returns shards of the dataset with paths relative to the current directory (directory of the index prepended)
+	 */
+	std::vector<ShardInfo> ReadShardIndex(const std::string& path);
+
+	/**
+	 * @brief Converting a float to bfloat16 (round to nearest even).
+	 */
+	uint16_t FloatToBfloat16(float value);
+
+	/**
+	 * @brief Converting a bfloat16 to float.
+	 */
+	float Bfloat16ToFloat(uint16_t value);
+}
+
+#endif // !DATASET_FILE_H
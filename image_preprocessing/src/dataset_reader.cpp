@@ -0,0 +1,208 @@
+/**
+* @file dataset_reader.cpp
+* @brief Implementation of DatasetReader class.
+*/
+
+#include "dataset_reader.h"
+#include <cstring>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+using namespace std;
+using namespace cv;
+
+namespace
+{
+	/**
+	 * OpenCV depth of the values of saved data type.
+	 */
+	int RecordDepth(DataType dtype)
+	{
+		switch (dtype) {
+		case float32: return CV_32F;
+		case float16: return CV_16S;
+		case bfloat16: return CV_16U;
+		case uint8: return CV_8U;
+		case int8: return CV_8S;
+		default: throw invalid_argument("DatasetReader: unknown data type");
+		}
+	}
+
+	int32_t ReadInt(const char* data)
+	{
+		int32_t value;
+		memcpy(&value, data, sizeof(value));
+		return value;
+	}
+}
+
+/**
+ * Throws an invalid argument error when the file is not a valid dataset file.
+ */
+DatasetReader::DatasetReader(const string& path, bool populate) : file(path), version(1), num_records(0), dtype(float32),
+	element_size(sizeof(float)), labels(nullptr), data_offset(0), record_size(0)
+{
+	if (dataset_file::IsVersion2(file.GetData(), file.GetSize())) OpenVersion2();
+	else OpenVersion1();
+	if (dataset_file::IsQuantized(dtype)) CheckQuantization();
+	if (populate) file.Prefetch(0, file.GetSize());
+}
+
+/**
+ * Quantization parameters are parsed from the part of the file before the labels, arrays are only checked to lie inside the file.
+ */
+void DatasetReader::OpenVersion2()
+{
+	DatasetHeader header;
+	memcpy(&header, file.GetData(), sizeof(header));
+	if (header.version != dataset_file::format_version || header.label_type != dataset_file::label_int32 || header.num_records < 0) {
+		throw invalid_argument("DatasetReader: unsupported dataset file: " + file.GetPath());
+	}
+	version = header.version;
+	num_records = header.num_records;
+	dtype = static_cast<DataType>(header.dtype);
+	element_size = dataset_file::ElementSize(dtype);
+	data_offset = header.data_offset;
+	record_size = header.record_size;
+
+	if (header.quantization_offset) {
+		const int64_t length = header.labels_offset - header.quantization_offset;
+		CheckRange(header.quantization_offset, length);
+		istringstream stream(string(file.GetData() + header.quantization_offset, static_cast<size_t>(length)));
+		quantization = dataset_file::ReadQuantization(stream);
+	}
+
+	CheckRange(header.labels_offset, num_records * static_cast<int64_t>(sizeof(int32_t)));
+	labels = reinterpret_cast<const int32_t*>(file.GetData() + header.labels_offset);
+
+	if (record_size < 0) throw invalid_argument("DatasetReader: dataset file is truncated or corrupted: " + file.GetPath());
+	if (record_size == 0 && num_records > 0) {
+		CheckRange(header.offsets_offset, (num_records + 1) * static_cast<int64_t>(sizeof(int64_t)));
+		const int64_t* offsets = reinterpret_cast<const int64_t*>(file.GetData() + header.offsets_offset);
+		if (offsets[0] != 0) throw invalid_argument("DatasetReader: dataset file is truncated or corrupted: " + file.GetPath());
+		CheckRange(data_offset, offsets[num_records]);
+		record_offsets.assign(offsets, offsets + num_records);
+		record_sizes.reserve(static_cast<size_t>(num_records));
+		for (int64_t i = 0; i < num_records; i++) {
+			// offsets are non-decreasing (last one checked against the file) and every record has whole values
+			const int64_t length = offsets[i + 1] - offsets[i];
+			if (length < 0 || length % static_cast<int64_t>(element_size) != 0 ||
+				length / static_cast<int64_t>(element_size) > (numeric_limits<int32_t>::max)()) {
+				throw invalid_argument("DatasetReader: dataset file is truncated or corrupted: " + file.GetPath());
+			}
+			record_sizes.push_back(static_cast<int32_t>(length / static_cast<int64_t>(element_size)));
+		}
+	}
+	else {
+		const int64_t record_bytes = record_size * static_cast<int64_t>(element_size);
+		if (record_bytes > 0 && num_records > static_cast<int64_t>(file.GetSize()) / record_bytes) {
+			throw invalid_argument("DatasetReader: dataset file is truncated or corrupted: " + file.GetPath());
+		}
+		CheckRange(data_offset, num_records * record_bytes);
+	}
+}
+
+/**
+ * Version 1 file: |extended header (optional)|number of images (int)| number of images x |size (int)|values|| labels |
+ * Every record is preceded by its size, so the sizes are read once to find the records (values are not touched).
+ */
+void DatasetReader::OpenVersion1()
+{
+	int64_t position = 0;
+	CheckRange(position, sizeof(int32_t));
+	int32_t count = ReadInt(file.GetData());
+	position += sizeof(int32_t);
+	if (count == dataset_file::extended_header_marker) {
+		CheckRange(position, sizeof(int32_t));
+		dtype = static_cast<DataType>(ReadInt(file.GetData() + position));
+		position += sizeof(int32_t);
+		if (dataset_file::IsQuantized(dtype)) {
+			CheckRange(position, sizeof(int32_t));
+			const int32_t num_channels = ReadInt(file.GetData() + position);
+			const int64_t length = 2 * sizeof(int32_t) + static_cast<int64_t>(num_channels) * (2 * sizeof(int32_t) + sizeof(float));
+			CheckRange(position, length);
+			istringstream stream(string(file.GetData() + position, static_cast<size_t>(length)));
+			quantization = dataset_file::ReadQuantization(stream);
+			position += length;
+		}
+		CheckRange(position, sizeof(int32_t));
+		count = ReadInt(file.GetData() + position);
+		position += sizeof(int32_t);
+	}
+	if (count < 0) throw invalid_argument("DatasetReader: not a dataset file: " + file.GetPath());
+	element_size = dataset_file::ElementSize(dtype);
+	num_records = count;
+
+	// every record has at least its size field, so the count is bounded by the file before anything is reserved
+	if (count > (static_cast<int64_t>(file.GetSize()) - position) / static_cast<int64_t>(sizeof(int32_t))) {
+		throw invalid_argument("DatasetReader: dataset file is truncated or corrupted: " + file.GetPath());
+	}
+	record_offsets.reserve(count);
+	record_sizes.reserve(count);
+	for (int32_t i = 0; i < count; i++) {
+		CheckRange(position, sizeof(int32_t));
+		const int32_t size = ReadInt(file.GetData() + position);
+		position += sizeof(int32_t);
+		CheckRange(position, size * static_cast<int64_t>(element_size));
+		record_offsets.push_back(position);
+		record_sizes.push_back(size);
+		position += size * static_cast<int64_t>(element_size);
+	}
+	CheckRange(position, count * static_cast<int64_t>(sizeof(int32_t)));
+	labels = reinterpret_cast<const int32_t*>(file.GetData() + position);
+}
+
+void DatasetReader::CheckRange(int64_t offset, int64_t length) const
+{
+	const int64_t size = static_cast<int64_t>(file.GetSize());
+	if (offset < 0 || length < 0 || length > size || offset > size - length) {
+		throw invalid_argument("DatasetReader: dataset file is truncated or corrupted: " + file.GetPath());
+	}
+}
+
+/**
+ * Checked once when the file is opened, so decoding never converts a channel past the end of a record.
+ */
+void DatasetReader::CheckQuantization() const
+{
+	int64_t channels_size = 0;
+	for (auto channel_size : quantization.channel_sizes) channels_size += channel_size;
+	for (int64_t i = 0; i < num_records; i++) {
+		if (GetRecordSize(i) != channels_size) {
+			throw invalid_argument("DatasetReader: quantization parameters do not match the record size: " + file.GetPath());
+		}
+	}
+}
+
+int64_t DatasetReader::RecordOffset(int64_t index) const
+{
+	return (record_size > 0) ? index * record_size * static_cast<int64_t>(element_size) : record_offsets[index];
+}
+
+int DatasetReader::GetRecordSize(int64_t index) const
+{
+	return (record_size > 0) ? record_size : record_sizes[index];
+}
+
+Mat DatasetReader::GetRecord(int64_t index) const
+{
+	if (index < 0 || index >= num_records) throw invalid_argument("GetRecord: record index out of range");
+	char* data = const_cast<char*>(file.GetData()) + data_offset + RecordOffset(index);
+	return Mat(1, GetRecordSize(index), RecordDepth(dtype), data);
+}
+
+void DatasetReader::DecodeRecord(int64_t index, float* dst) const
+{
+	const Mat record = GetRecord(index);
+	dataset_file::DecodeRecord(record.data, dst, record.cols, dtype, quantization);
+}
+
+void DatasetReader::Prefetch(int64_t begin, int64_t count) const
+{
+	if (count <= 0 || begin < 0 || begin >= num_records) return;
+	const int64_t end = (begin + count < num_records) ? begin + count : num_records;
+	const int64_t first = data_offset + RecordOffset(begin);
+	const int64_t last = data_offset + RecordOffset(end - 1) + GetRecordSize(end - 1) * static_cast<int64_t>(element_size);
+	file.Prefetch(static_cast<size_t>(first), static_cast<size_t>(last - first));
+}
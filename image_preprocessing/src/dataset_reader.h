@@ -0,0 +1,103 @@
+/**
+* @file dataset_reader.h
+* @brief Reading saved datasets from a memory mapped file (DatasetReader class).
+*/
+
+#ifndef DATASET_READER_H
+#define DATASET_READER_H
+
+#include "dataset_file.h"
+#include "mapped_file.h"
+#include <opencv2/core/core.hpp>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Read-only access to a dataset saved with DataLoader::SaveFormattedData() (version 1 or 2 file).
+ * The file is memory mapped - records and labels are returned as headers pointing to the mapped memory, without copying.
+ * Records of version 2 files are found in O(1), version 1 files are indexed once (sizes of the records are read) when opened.
+ */
+class DatasetReader {
+
+public:
+	/**
+	 * @brief DatasetReader constructor - mapping the file and reading its header.
+	 * @param path path to the dataset file
+	 * @param populate flag for reading the whole file ahead in the background (for reading all the records)
+	 */
+	explicit DatasetReader(const std::string& path, bool populate = false);
+
+	DatasetReader(const DatasetReader&) = delete;
+	DatasetReader& operator=(const DatasetReader&) = delete;
+
+	/**
+	 * @brief Record with given index in the saved data type (without copying).
+	 * @param index index of the record
+	 * @returns 1 x record size Mat pointing to the mapped file (CV_32F - float32, CV_16S - float16, CV_16U - bfloat16,
+	 * CV_8U - uint8, CV_8S - int8), valid as long as the reader exists
+	 */
+	cv::Mat GetRecord(int64_t index) const;
+
+	/**
+	 * @brief Converting (or dequantizing) a record to floats.
+	 * @param index index of the record
+	 * @param dst pointer to output floats (GetRecordSize(index) values)
+	 */
+	void DecodeRecord(int64_t index, float* dst) const;
+
+	/**
+	 * @brief Reading the pages of consecutive records ahead in the background.
+	 * @param begin index of the first record
+	 * @param count number of records
+	 */
+	void Prefetch(int64_t begin, int64_t count) const;
+
+	int GetRecordSize(int64_t index) const;
+	int GetLabel(int64_t index) const { return labels[index]; }
+	const int32_t* GetLabels() const { return labels; }
+	int64_t GetNumRecords() const { return num_records; }
+	DataType GetDataType() const { return dtype; }
+	int GetVersion() const { return version; }
+	const QuantizationParameters& GetQuantization() const { return quantization; }
+
+private:
+	MappedFile file; /**< Mapped dataset file */
+	int version; /**< Version of the file format */
+	int64_t num_records; /**< Number of records */
+	DataType dtype; /**< Data type of the values */
+	size_t element_size; /**< Size of a value in bytes */
+	QuantizationParameters quantization; /**< Quantization parameters (uint8/int8 data types) */
+	const int32_t* labels; /**< Labels (in the mapped file) */
+	int64_t data_offset; /**< Offset of the first record */
+	int record_size; /**< Number of values in every record (0 - records of different sizes) */
+	std::vector<int64_t> record_offsets; /**< Offsets of the records relative to data_offset (only if record_size is 0) */
+	std::vector<int32_t> record_sizes; /**< Number of values in every record (only if record_size is 0) */
+
+	/**
+	 * @brief Reading the header and the arrays of a version 2 file.
+	 */
+	void OpenVersion2();
+
+	/**
+	 * @brief Reading the header of a version 1 file and indexing its records.
+	 */
+	void OpenVersion1();
+
+	/**
+	 * @brief Offset of a record relative to data_offset.
+	 */
+	int64_t RecordOffset(int64_t index) const;
+
+	/**
+	 * @brief Checking if a part of the file is inside the file (throws invalid argument error otherwise).
+	 */
+	void CheckRange(int64_t offset, int64_t length) const;
+
+	/**
+	 * @brief Checking if the channels of the quantization parameters cover every record exactly (throws invalid argument error otherwise).
+	 */
+	void CheckQuantization() const;
+};
+
+#endif // !DATASET_READER_H
@@ -0,0 +1,214 @@
+/**
+* @file dataset_statistics.cpp
+* @brief Dataset-wide statistics - implementation.
+*/
+
+#include "dataset_statistics.h"
+#include <fstream>
+#include <numeric>
+#include <algorithm>
+#include <stdexcept>
+#include <cmath>
+
+using namespace std;
+
+namespace
+{
+	const char statistics_magic[4] = { 'P', 'P', 'S', 'T' };
+	const int statistics_version = 2;
+
+	/**
+	 * Merging mean and sum of squared differences of two sets of values (Chan et al. pairwise update).
+	 */
+	void MergeMoments(double& mean_a, double& m2_a, double n_a, double mean_b, double m2_b, double n_b)
+	{
+		const double n = n_a + n_b;
+		if (n == 0) return;
+		const double delta = mean_b - mean_a;
+		mean_a += delta * n_b / n;
+		m2_a += m2_b + delta * delta * n_a * n_b / n;
+	}
+
+	/**
+	 * Position of the first value of a channel in the formatted vector and distance between consecutive values of the channel.
+	 */
+	void ChannelPosition(const vector<int>& channel_sizes, bool interleaved, size_t channel, size_t& offset, size_t& stride)
+	{
+		if (interleaved) {
+			offset = channel;
+			stride = channel_sizes.size();
+		}
+		else {
+			offset = accumulate(channel_sizes.begin(), channel_sizes.begin() + channel, size_t(0));
+			stride = 1;
+		}
+	}
+}
+
+/**
+ * Mean image is subtracted element-wise, channel normalization subtracts the channel mean and divides by the channel std.
+ * Formatted vector size must match the statistics, otherwise throws an invalid argument error.
+ */
+void DatasetStatistics::Normalize(vector<float>& data, NormalizationType type) const
+{
+	if (type == mean_image) {
+		if (data.size() != mean.size()) throw invalid_argument("Normalize: data size does not match the mean image size");
+		for (size_t i = 0; i < data.size(); i++) data[i] -= mean[i];
+	}
+	else if (type == channel_mean_std) {
+		if (data.size() != static_cast<size_t>(accumulate(channel_sizes.begin(), channel_sizes.end(), 0)))
+			throw invalid_argument("Normalize: data size does not match the channel sizes");
+		for (size_t c = 0; c < channel_sizes.size(); c++) {
+			const float channel_mean_f = static_cast<float>(channel_mean[c]);
+			const float inv_std = (channel_std[c] > 1e-12) ? static_cast<float>(1.0 / channel_std[c]) : 1.f;
+			size_t offset, stride;
+			ChannelPosition(channel_sizes, interleaved, c, offset, stride);
+			for (size_t k = 0, i = offset; k < static_cast<size_t>(channel_sizes[c]); k++, i += stride) data[i] = (data[i] - channel_mean_f) * inv_std;
+		}
+	}
+}
+
+/**
+ * File format:
+ * |magic "PPST"|version (int)|number of channels (int)| number of channels x |channel size (int)| |interleaved (char)|number of images (int64)|
+ * |number of values x |mean image value (float)|| number of channels x |channel mean (double)|channel std (double)||
+ */
+void DatasetStatistics::Save(const string& path) const
+{
+	ofstream file(path, ios::out | ofstream::binary | ios::trunc);
+	if (!file) throw invalid_argument("DatasetStatistics::Save: file could not be opened: " + path);
+
+	const int num_channels = static_cast<int>(channel_sizes.size());
+	file.write(statistics_magic, sizeof(statistics_magic));
+	file.write(reinterpret_cast<const char*>(&statistics_version), sizeof(statistics_version));
+	file.write(reinterpret_cast<const char*>(&num_channels), sizeof(num_channels));
+	file.write(reinterpret_cast<const char*>(channel_sizes.data()), num_channels * sizeof(int));
+	const char interleaved_flag = interleaved ? 1 : 0;
+	file.write(&interleaved_flag, sizeof(interleaved_flag));
+	file.write(reinterpret_cast<const char*>(&count), sizeof(count));
+	file.write(reinterpret_cast<const char*>(mean.data()), mean.size() * sizeof(float));
+	for (int c = 0; c < num_channels; c++) {
+		file.write(reinterpret_cast<const char*>(&channel_mean[c]), sizeof(double));
+		file.write(reinterpret_cast<const char*>(&channel_std[c]), sizeof(double));
+	}
+	file.close();
+}
+
+/**
+ * Version 1 files (written before the interleaved flag was added) are read as not interleaved.
+ * Channel sizes are checked against the file size before the arrays are allocated.
+ */
+DatasetStatistics DatasetStatistics::Load(const string& path)
+{
+	ifstream file(path, ios::in | ifstream::binary | ifstream::ate);
+	if (!file) throw invalid_argument("DatasetStatistics::Load: Invalid path: " + path + " , file could not be read");
+	const int64_t file_size = file.tellg();
+	file.seekg(0, ios::beg);
+
+	char magic[4];
+	int version = 0;
+	int num_channels = 0;
+	file.read(magic, sizeof(magic));
+	file.read(reinterpret_cast<char*>(&version), sizeof(version));
+	if (!equal(magic, magic + 4, statistics_magic) || version < 1 || version > statistics_version)
+		throw invalid_argument("DatasetStatistics::Load: " + path + " is not a statistics file");
+
+	DatasetStatistics statistics;
+	file.read(reinterpret_cast<char*>(&num_channels), sizeof(num_channels));
+	if (!file || num_channels <= 0 || num_channels > (file_size - static_cast<int64_t>(file.tellg())) / static_cast<int64_t>(sizeof(int)))
+		throw invalid_argument("DatasetStatistics::Load: " + path + " is truncated or corrupted");
+	statistics.channel_sizes.resize(num_channels);
+	file.read(reinterpret_cast<char*>(statistics.channel_sizes.data()), num_channels * sizeof(int));
+	int64_t total_size = 0;
+	for (auto channel_size : statistics.channel_sizes) {
+		if (channel_size <= 0) throw invalid_argument("DatasetStatistics::Load: " + path + " is truncated or corrupted");
+		total_size += channel_size;
+	}
+	char interleaved_flag = 0;
+	if (version >= 2) file.read(&interleaved_flag, sizeof(interleaved_flag));
+	statistics.interleaved = interleaved_flag != 0;
+	file.read(reinterpret_cast<char*>(&statistics.count), sizeof(statistics.count));
+	const int64_t payload = total_size * static_cast<int64_t>(sizeof(float)) + num_channels * static_cast<int64_t>(2 * sizeof(double));
+	if (!file || payload > file_size - static_cast<int64_t>(file.tellg()))
+		throw invalid_argument("DatasetStatistics::Load: " + path + " is truncated or corrupted");
+	statistics.mean.resize(static_cast<size_t>(total_size));
+	file.read(reinterpret_cast<char*>(statistics.mean.data()), statistics.mean.size() * sizeof(float));
+	statistics.channel_mean.resize(num_channels);
+	statistics.channel_std.resize(num_channels);
+	for (int c = 0; c < num_channels; c++) {
+		file.read(reinterpret_cast<char*>(&statistics.channel_mean[c]), sizeof(double));
+		file.read(reinterpret_cast<char*>(&statistics.channel_std[c]), sizeof(double));
+	}
+	if (!file) throw invalid_argument("DatasetStatistics::Load: " + path + " is truncated");
+	return statistics;
+}
+
+
+StatisticsAccumulator::StatisticsAccumulator(vector<int> channel_sizes, bool interleaved) :
+	channel_sizes(move(channel_sizes)), interleaved(interleaved), count(0)
+{
+	mean.assign(accumulate(this->channel_sizes.begin(), this->channel_sizes.end(), 0), 0.0);
+	channel_mean.assign(this->channel_sizes.size(), 0.0);
+	channel_m2.assign(this->channel_sizes.size(), 0.0);
+}
+
+/**
+ * Per-pixel mean is updated with Welford's recurrence.
+ * Channel moments of the sample are computed exactly (two passes over the sample) and merged with the running ones.
+ */
+void StatisticsAccumulator::Add(const vector<float>& sample)
+{
+	if (sample.size() != mean.size()) throw invalid_argument("StatisticsAccumulator: Inconsistent data size!");
+
+	const double n_before = static_cast<double>(count);
+	count++;
+	const double inv_count = 1.0 / count;
+	for (size_t i = 0; i < mean.size(); i++) mean[i] += (sample[i] - mean[i]) * inv_count;
+
+	for (size_t c = 0; c < channel_sizes.size(); c++) {
+		size_t offset, stride;
+		ChannelPosition(channel_sizes, interleaved, c, offset, stride);
+		const size_t end = offset + channel_sizes[c] * stride;
+		double sample_mean = 0;
+		for (size_t i = offset; i < end; i += stride) sample_mean += sample[i];
+		sample_mean /= channel_sizes[c];
+		double sample_m2 = 0;
+		for (size_t i = offset; i < end; i += stride) {
+			const double delta = sample[i] - sample_mean;
+			sample_m2 += delta * delta;
+		}
+		MergeMoments(channel_mean[c], channel_m2[c], n_before * channel_sizes[c], sample_mean, sample_m2, channel_sizes[c]);
+	}
+}
+
+void StatisticsAccumulator::Merge(const StatisticsAccumulator& other)
+{
+	if (other.channel_sizes != channel_sizes || other.interleaved != interleaved) throw invalid_argument("StatisticsAccumulator: Inconsistent data size!");
+	if (other.count == 0) return;
+
+	const double n_a = static_cast<double>(count);
+	const double n_b = static_cast<double>(other.count);
+	const double weight_b = n_b / (n_a + n_b);
+	for (size_t i = 0; i < mean.size(); i++) mean[i] += (other.mean[i] - mean[i]) * weight_b;
+
+	for (size_t c = 0; c < channel_sizes.size(); c++) {
+		MergeMoments(channel_mean[c], channel_m2[c], n_a * channel_sizes[c], other.channel_mean[c], other.channel_m2[c], n_b * channel_sizes[c]);
+	}
+	count += other.count;
+}
+
+DatasetStatistics StatisticsAccumulator::Finish() const
+{
+	DatasetStatistics statistics;
+	statistics.count = count;
+	statistics.channel_sizes = channel_sizes;
+	statistics.interleaved = interleaved;
+	statistics.mean.assign(mean.begin(), mean.end());
+	statistics.channel_mean = channel_mean;
+	statistics.channel_std.resize(channel_sizes.size());
+	for (size_t c = 0; c < channel_sizes.size(); c++) {
+		const double n = static_cast<double>(count) * channel_sizes[c];
+		statistics.channel_std[c] = (n > 0) ? sqrt(channel_m2[c] / n) : 0.0;
+	}
+	return statistics;
+}
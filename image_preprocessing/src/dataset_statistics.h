@@ -0,0 +1,99 @@
+/**
+* @file dataset_statistics.h
+* @brief Dataset-wide statistics used for normalization of formatted data.
+*/
+
+#ifndef DATASET_STATISTICS_H
+#define DATASET_STATISTICS_H
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+/**
+ *  Enum for available types of dataset normalization.
+ *  Default char values for easier commandline arguments parsing.
+ */
+enum NormalizationType {
+	no_normalization = 0,
+	mean_image = 'i',
+	channel_mean_std = 'c'
+};
+
+/**
+ * @brief Statistics of the formatted (not normalized) data of the whole dataset.
+ * Channels are consecutive segments of the formatted vector (luminance, u, v) or are interleaved (nhwc layout).
+ */
+struct DatasetStatistics {
+
+	int64_t count; /**< Number of images the statistics were computed from */
+	std::vector<int> channel_sizes; /**< Number of values in each channel */
+	bool interleaved; /**< Flag for interleaved channels */
+	std::vector<float> mean; /**< Per-pixel mean image (size of the formatted vector) */
+	std::vector<double> channel_mean; /**< Mean of all the values in a channel */
+	std::vector<double> channel_std; /**< Standard deviation of all the values in a channel */
+
+	/**
+	 * @brief Normalizing formatted data of a single image.
+	 * @param data formatted data (vector of floats), modified in the function
+	 * @param type normalization type (mean_image or channel_mean_std)
+	 */
+	void Normalize(std::vector<float>& data, NormalizationType type) const;
+
+	/**
+	 * @brief Saving statistics to a binary file.
+	 * @param path path where the file should be saved
+	 */
+	void Save(const std::string& path) const;
+
+	/**
+	 * @brief Reading statistics previously saved with Save().
+	 * @param path path to the file
+	 * @returns statistics read from the file
+	 */
+	static DatasetStatistics Load(const std::string& path);
+};
+
+/**
+ * @brief Streaming accumulator of dataset statistics.
+ * Images are added one by one (Welford updates), partial accumulators computed by separate threads are merged with Merge().
+ */
+class StatisticsAccumulator {
+
+public:
+	/**
+	 * @brief StatisticsAccumulator constructor.
+	 * @param channel_sizes number of values in each channel of the formatted vector
+	 * @param interleaved flag for interleaved channels (channel sizes must be equal)
+	 */
+	explicit StatisticsAccumulator(std::vector<int> channel_sizes, bool interleaved = false);
+
+	/**
+	 * @brief Adding formatted data of a single image.
+	 * @param sample formatted (not normalized) data
+	 */
+	void Add(const std::vector<float>& sample);
+
+	/**
+	 * @brief Merging statistics accumulated by another accumulator.
+	 * @param other accumulator with the same channel sizes
+	 */
+	void Merge(const StatisticsAccumulator& other);
+
+	/**
+	 * @brief Computing final statistics.
+	 */
+	DatasetStatistics Finish() const;
+
+	int64_t GetCount() const { return count; }
+
+private:
+	std::vector<int> channel_sizes; /**< Number of values in each channel */
+	bool interleaved; /**< Flag for interleaved channels */
+	int64_t count; /**< Number of images added */
+	std::vector<double> mean; /**< Running per-pixel mean */
+	std::vector<double> channel_mean; /**< Running mean of each channel */
+	std::vector<double> channel_m2; /**< Running sum of squared differences from the mean of each channel */
+};
+
+#endif // !DATASET_STATISTICS_H
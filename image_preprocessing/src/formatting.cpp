@@ -0,0 +1,173 @@
+/**
+* @file formatting.cpp
+* @brief Implementation of functions formatting processed images for neural network input.
+*/
+
+#include "formatting.h"
+#include <opencv2/core/hal/intrin.hpp>
+#include <cstring>
+
+using namespace cv;
+using namespace std;
+
+namespace formatting
+{
+	namespace
+	{
+		/**
+		 * Conversion of a row of 8-bit pixels to floats scaled by 1/256, 16 pixels per iteration.
+		 */
+		void ConvertRow8U(const uchar* src, float* dst, int n)
+		{
+			const float scale = 1.f / 256;
+			int j = 0;
+#if CV_SIMD128
+			const v_float32x4 v_scale = v_setall_f32(scale);
+			for (; j <= n - 16; j += 16) {
+				v_uint16x8 v_low16, v_high16;
+				v_expand(v_load(src + j), v_low16, v_high16);
+				v_uint32x4 v_0, v_1, v_2, v_3;
+				v_expand(v_low16, v_0, v_1);
+				v_expand(v_high16, v_2, v_3);
+				v_store(dst + j, v_cvt_f32(v_reinterpret_as_s32(v_0)) * v_scale);
+				v_store(dst + j + 4, v_cvt_f32(v_reinterpret_as_s32(v_1)) * v_scale);
+				v_store(dst + j + 8, v_cvt_f32(v_reinterpret_as_s32(v_2)) * v_scale);
+				v_store(dst + j + 12, v_cvt_f32(v_reinterpret_as_s32(v_3)) * v_scale);
+			}
+#endif
+			for (; j < n; j++) dst[j] = src[j] * scale;
+		}
+
+		/**
+		 * Conversion of a row of fixed-point pixels (CV_16S) to floats scaled as 8-bit pixels (1/256 per 8-bit step), 8 pixels per iteration.
+		 */
+		void ConvertRow16S(const short* src, float* dst, int n)
+		{
+			const float scale = 1.f / (256 << fixed_point_bits);
+			int j = 0;
+#if CV_SIMD128
+			const v_float32x4 v_scale = v_setall_f32(scale);
+			for (; j <= n - 8; j += 8) {
+				v_int32x4 v_low, v_high;
+				v_expand(v_load(src + j), v_low, v_high);
+				v_store(dst + j, v_cvt_f32(v_low) * v_scale);
+				v_store(dst + j + 4, v_cvt_f32(v_high) * v_scale);
+			}
+#endif
+			for (; j < n; j++) dst[j] = src[j] * scale;
+		}
+
+		/**
+		 * Conversion of a row of 16-bit pixels (CV_16U) to floats scaled by 1/65536, 8 pixels per iteration.
+		 */
+		void ConvertRow16U(const ushort* src, float* dst, int n)
+		{
+			const float scale = 1.f / 65536;
+			int j = 0;
+#if CV_SIMD128
+			const v_float32x4 v_scale = v_setall_f32(scale);
+			for (; j <= n - 8; j += 8) {
+				v_uint32x4 v_low, v_high;
+				v_expand(v_load(src + j), v_low, v_high);
+				v_store(dst + j, v_cvt_f32(v_reinterpret_as_s32(v_low)) * v_scale);
+				v_store(dst + j + 4, v_cvt_f32(v_reinterpret_as_s32(v_high)) * v_scale);
+			}
+#endif
+			for (; j < n; j++) dst[j] = src[j] * scale;
+		}
+
+		/**
+		 * Upsampling a decimated chrominance to the luminance size.
+		 */
+		Mat Upsample(const Mat& chrominance, const Size& size)
+		{
+			if (chrominance.size() == size) return chrominance;
+			Mat upsampled;
+			resize(chrominance, upsampled, size, 0, 0, INTER_LINEAR);
+			return upsampled;
+		}
+	}
+
+	/**
+	 * Accepts 1-channel Mats with format CV_8U (pixel values 0-255), CV_16U (pixel values 0-65535), CV_16S (fixed point) or CV_32F (pixel values 0-1),
+	 * multichannel Mats are treated as interleaved rows. Other types throw an invalid argument error.
+	 * Conversion and scaling are done in one pass, row by row (also for non-continuous Mats).
+	 */
+	void ConvertPlane(const Mat& plane, float* out, const float* lut)
+	{
+		const int row_size = plane.cols * plane.channels();
+		for (int i = 0; i < plane.rows; i++, out += row_size) {
+			if (plane.depth() == CV_8U) {
+				const uchar* row = plane.ptr<uchar>(i);
+				if (lut) {
+					for (int j = 0; j < row_size; j++) out[j] = lut[row[j]];
+				}
+				else ConvertRow8U(row, out, row_size);
+			}
+			else if (plane.depth() == CV_16U) ConvertRow16U(plane.ptr<ushort>(i), out, row_size);
+			else if (plane.depth() == CV_16S) ConvertRow16S(plane.ptr<short>(i), out, row_size);
+			else if (plane.depth() == CV_32F) memcpy(out, plane.ptr<float>(i), row_size * sizeof(float));
+			else throw invalid_argument("ConvertPlane: uncorrect Mat type (only CV_8U, CV_16U, CV_16S and CV_32F accepted)");
+		}
+	}
+
+	/**
+	 * Planar layout keeps chrominances decimated, nchw and nhwc upsample them to luminance resolution.
+	 * For nhwc 8-bit planes with the same look-up table are interleaved before the conversion (one float pass),
+	 * otherwise they are converted first and interleaved with cv::merge directly into the output.
+	 */
+	vector<int> FormatPlanes(const Mat& luminance, const Chrominances* color, OutputLayout layout,
+		vector<float>& out, const float* lut, const float* chroma_lut)
+	{
+		const size_t begin = out.size();
+
+		if (!color) {
+			out.resize(begin + luminance.total());
+			ConvertPlane(luminance, out.data() + begin, lut);
+			return { static_cast<int>(luminance.total()) };
+		}
+
+		if (layout == planar) {
+			const size_t luminance_size = luminance.total();
+			const size_t chroma_size = color->u.total();
+			out.resize(begin + luminance_size + 2 * chroma_size);
+			ConvertPlane(luminance, out.data() + begin, lut);
+			ConvertPlane(color->u, out.data() + begin + luminance_size, chroma_lut);
+			ConvertPlane(color->v, out.data() + begin + luminance_size + chroma_size, chroma_lut);
+			return { static_cast<int>(luminance_size), static_cast<int>(chroma_size), static_cast<int>(chroma_size) };
+		}
+
+		const Mat u = Upsample(color->u, luminance.size());
+		const Mat v = Upsample(color->v, luminance.size());
+		const int plane_size = static_cast<int>(luminance.total());
+		out.resize(begin + 3 * plane_size);
+		float* dst = out.data() + begin;
+
+		if (layout == nchw) {
+			ConvertPlane(luminance, dst, lut);
+			ConvertPlane(u, dst + plane_size, chroma_lut);
+			ConvertPlane(v, dst + 2 * plane_size, chroma_lut);
+		}
+		else if (layout == nhwc) {
+			const bool same_depth = luminance.depth() == u.depth() && luminance.depth() == v.depth();
+			if (same_depth && (luminance.depth() != CV_8U || lut == chroma_lut)) {
+				Mat interleaved;
+				merge(vector<Mat>{ luminance, u, v }, interleaved);
+				ConvertPlane(interleaved, dst, lut);
+			}
+			else {
+				vector<Mat> float_planes(3);
+				const Mat* planes[] = { &luminance, &u, &v };
+				for (int c = 0; c < 3; c++) {
+					float_planes[c].create(luminance.size(), CV_32F);
+					ConvertPlane(*planes[c], float_planes[c].ptr<float>(), c == 0 ? lut : chroma_lut);
+				}
+				Mat interleaved(luminance.size(), CV_32FC3, dst);
+				merge(float_planes, interleaved);
+			}
+		}
+		else throw invalid_argument("FormatPlanes: unknown output layout");
+
+		return { plane_size, plane_size, plane_size };
+	}
+}
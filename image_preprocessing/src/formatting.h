@@ -0,0 +1,53 @@
+/**
+* @file formatting.h
+* @brief Formatting namespace with functions converting processed images to neural network input.
+*/
+
+#ifndef FORMATTING_H
+#define FORMATTING_H
+
+#include "preprocessing_functions.h"
+#include <vector>
+
+/**
+ *  Enum for available layouts of formatted data.
+ *  Default char values for easier commandline arguments parsing.
+ */
+enum OutputLayout {
+	planar = 'p', /**< luminance followed by decimated u and v chrominances */
+	nchw = 'c', /**< channel-major, chrominances upsampled to luminance resolution */
+	nhwc = 'h' /**< pixel-major (interleaved yuv), chrominances upsampled to luminance resolution */
+};
+
+namespace formatting
+{
+	/**
+	 * @brief Converting a single image plane to floats, written directly to the output buffer.
+	 * @param plane 1-channel image (CV_8U - pixel values 0-255, CV_16U - pixel values 0-65535, CV_16S - fixed point or CV_32F - pixel values 0-1)
+	 * @param out pointer to the output buffer (plane.total() floats)
+	 * @param lut float look-up table used for CV_8U planes instead of scaling (nullptr - scaling by 1/256)
+	 */
+	void ConvertPlane(const cv::Mat& plane, float* out, const float* lut = nullptr);
+
+	/**
+	 * @brief Formatting luminance and chrominances to vector of floats in the chosen layout.
+	 * @param luminance luminance (or grayscale image)
+	 * @param color pointer to chrominances structure (nullptr for grayscale images)
+	 * @param layout output layout
+	 * @param out output vector, formatted data is appended to it
+	 * @param lut float look-up table for the CV_8U luminance (nullptr - scaling by 1/256)
+	 * @param chroma_lut float look-up table for the CV_8U chrominances (nullptr - scaling by 1/256)
+	 * @returns number of values in each channel
+	 */
+	std::vector<int> FormatPlanes(const cv::Mat& luminance, const Chrominances* color, OutputLayout layout,
+		std::vector<float>& out, const float* lut = nullptr, const float* chroma_lut = nullptr);
+
+	/**
+	 * @brief Checking if channels of formatted data are interleaved.
+	 * @param layout output layout
+	 * @param num_channels number of channels
+	 */
+	inline bool IsInterleaved(OutputLayout layout, size_t num_channels) { return layout == nhwc && num_channels > 1; }
+}
+
+#endif // !FORMATTING_H
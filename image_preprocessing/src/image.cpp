@@ -15,22 +15,42 @@ using namespace cv;
  * mean - false
  * negative - false
  * pca - false
+ * chroma - false
+ * pointwise_ops - {}
+ * standardize - false
+ * lcn_window - 0
+ * pca_options - default PcaOptions
+ * random_projection - 0
+ * projection_seed - 0
+ * native_depth - false
+ * fixed_point - false
+ * layout - planar
+ * normalization - no_normalization
  */
 ProcessingConfiguration::ProcessingConfiguration() :
-	format(CV_LOAD_IMAGE_GRAYSCALE), filter(false), filter_types({}), mean(false), negative(false), pca(false)
+	format(CV_LOAD_IMAGE_GRAYSCALE), filter(false), filter_types({}), mean(false), negative(false), pca(false),
+	chroma(false), chroma_filter_types({}), pointwise_ops({}), standardize(false), lcn_window(0), pca_options(), random_projection(0), projection_seed(0), native_depth(false), fixed_point(false), layout(planar), normalization(no_normalization), statistics(nullptr)
 {
 }
 
-ProcessingConfiguration::ProcessingConfiguration(int format, bool filter, vector<FilterType> filter_types, bool mean, bool negative, bool pca) :
-	format(format), filter(filter), filter_types(filter_types), mean(mean), negative(negative), pca(pca)
+ProcessingConfiguration::ProcessingConfiguration(int format, bool filter, vector<FilterType> filter_types, bool mean, bool negative, bool pca,
+	bool chroma, vector<FilterType> chroma_filter_types) :
+	format(format), filter(filter), filter_types(filter_types), mean(mean), negative(negative), pca(pca),
+	chroma(chroma), chroma_filter_types(chroma_filter_types), pointwise_ops({}), standardize(false), lcn_window(0), pca_options(), random_projection(0), projection_seed(0), native_depth(false), fixed_point(false), layout(planar), normalization(no_normalization), statistics(nullptr)
 {
 }
 
 /**
  * Initial configuration values
  */
-ProcessingConfiguration Image::cfg (CV_LOAD_IMAGE_GRAYSCALE, false, {}, false, false, false);
+ProcessingConfiguration Image::cfg (CV_LOAD_IMAGE_GRAYSCALE, false, {}, false, false, false, false, {});
+Mat Image::pointwise_lut;
+vector<float> Image::pointwise_float_lut;
+Mat Image::pointwise_lut_16;
 
+/**
+ * Negative and pointwise operations are composed into one look-up table here, once per configuration.
+ */
 void Image::SetCfg(ProcessingConfiguration& new_cfg)
 {
 	Image::cfg = new_cfg;
@@ -39,12 +59,31 @@ void Image::SetCfg(ProcessingConfiguration& new_cfg)
 		throw invalid_argument("Invalid format, only CV_LOAD_IMAGE_COLOR (" + to_string(CV_LOAD_IMAGE_COLOR) +
 			") or CV_LOAD_IMAGE_GRAYSCALE (" + to_string(CV_LOAD_IMAGE_GRAYSCALE) + ") available");
 	}
-	
+	if (new_cfg.native_depth && new_cfg.fixed_point) throw invalid_argument("Fixed point processing is available only for 8-bit images");
+
+	vector<PointwiseOperation> operations;
+	if (new_cfg.negative) operations.push_back({ negative_op, 0, 0 });
+	operations.insert(operations.end(), new_cfg.pointwise_ops.begin(), new_cfg.pointwise_ops.end());
+
+	pointwise_lut = operations.empty() ? Mat() : preprocessing::ComposeLut(operations);
+	pointwise_float_lut.clear();
+	if (!pointwise_lut.empty()) {
+		for (int i = 0; i < 256; i++) pointwise_float_lut.push_back(pointwise_lut.at<uchar>(i) / 256.f);
+	}
+	pointwise_lut_16 = Mat();
+	if (!operations.empty() && (new_cfg.fixed_point || new_cfg.native_depth)) {
+		pointwise_lut_16 = preprocessing::ComposeLut16(operations, new_cfg.fixed_point ? CV_16S : CV_16U);
+	}
 };
 
+bool Image::CanFoldLut()
+{
+	return !pointwise_lut.empty() && !cfg.standardize && cfg.lcn_window <= 0 && !cfg.fixed_point;
+}
+
 
 
-Image::Image(const string path, int label): original(make_unique<Mat>(imread(path, cfg.format))), formatted(nullptr), label(label)
+Image::Image(const string path, int label): original(make_unique<Mat>(imread(path, cfg.format | (cfg.native_depth ? CV_LOAD_IMAGE_ANYDEPTH : 0)))), formatted(nullptr), label(label)
 {
 	if (!original || (original->cols == 0 && original->rows == 0)) throw invalid_argument("Image constructor: Invalid path: "+path+" , image could not be read");
 }
@@ -55,34 +94,23 @@ Image::Image(Mat img, int label): original(make_unique<Mat>(img)), formatted(nul
 }
 
 /**
- * Accepts Mats with format CV_8U (pixel values 0-255) or CV_32F (pixel values 0-1)
+ * The folded look-up table is used for chrominances only if they were processed (chroma option).
  */
-void Image::FormatMatForNn(Mat& img) const
+vector<int> Image::FormatPlanes(Mat& grayscale, Chrominances* color, vector<float>& out, bool fold_lut, bool force_planar) const
 {
-	Mat out_mat;
-	if (img.type() == CV_8U) {
-		img.convertTo(out_mat, CV_32F);
-		out_mat /= 256;
-	}
-	else out_mat = img;
-	for (int i = 0; i < out_mat.rows; ++i) {
-		formatted->insert(formatted->end(), out_mat.ptr<float>(i), out_mat.ptr<float>(i) + out_mat.cols);
-	}
+	const float* lut = fold_lut ? pointwise_float_lut.data() : nullptr;
+	const float* chroma_lut = cfg.chroma ? lut : nullptr;
+	return formatting::FormatPlanes(grayscale, color, force_planar ? planar : cfg.layout, out, lut, chroma_lut);
 }
 
 
 void Image::FormatDataForNn(unique_ptr<Mat> grayscale, unique_ptr<Chrominances> color)
 {
 	if (formatted) formatted->clear();
-	FormatMatForNn(*grayscale);
-
-	if (color) {
-		FormatMatForNn(color->u);
-		FormatMatForNn(color->v);
-	}
+	channel_sizes = FormatPlanes(*grayscale, color.get(), *formatted);
 }
 
-std::tuple<std::unique_ptr<cv::Mat>, std::unique_ptr<Chrominances>> Image::Process() const
+std::tuple<std::unique_ptr<cv::Mat>, std::unique_ptr<Chrominances>> Image::Process(bool defer_lut) const
 {
 	unique_ptr<Mat> grayscale = nullptr;
 	unique_ptr<Chrominances> color = nullptr;
@@ -93,22 +121,71 @@ std::tuple<std::unique_ptr<cv::Mat>, std::unique_ptr<Chrominances>> Image::Proce
 		color = make_unique<Chrominances>(yuvImg.chrominances);
 	}
 	else {
-		grayscale = make_unique<Mat>(*original);
+		// deep copy - in-place filters would otherwise modify the original image
+		grayscale = make_unique<Mat>(original->clone());
+	}
+
+	// Chrominances (already decimated) go through each stage right after the luminance, while they are still in cache.
+	vector<Mat*> chroma_planes;
+	if (color && cfg.chroma) chroma_planes = { &color->u, &color->v };
+
+	if (cfg.fixed_point) {
+		preprocessing::ConvertToFixedPoint(*grayscale);
+		for (auto plane : chroma_planes) preprocessing::ConvertToFixedPoint(*plane);
 	}
 
-	if (cfg.mean) preprocessing::SubtractMean(*grayscale);
+	if (cfg.mean) {
+		preprocessing::SubtractMean(*grayscale);
+		for (auto plane : chroma_planes) preprocessing::SubtractMean(*plane);
+	}
 
 	if (cfg.filter) {
-		for (auto f : cfg.filter_types) {
-			preprocessing::Filter(*grayscale, f);
+		const auto& chroma_filters = cfg.chroma_filter_types.empty() ? cfg.filter_types : cfg.chroma_filter_types;
+		const auto num_stages = max(cfg.filter_types.size(), chroma_filters.size());
+		for (size_t i = 0; i < num_stages; i++) {
+			if (i < cfg.filter_types.size()) preprocessing::Filter(*grayscale, cfg.filter_types[i]);
+			if (i < chroma_filters.size()) {
+				for (auto plane : chroma_planes) preprocessing::Filter(*plane, chroma_filters[i]);
+			}
 		}
 	}
 
-	if (cfg.negative) preprocessing::ConvertToNegative(*grayscale);
+	if (!pointwise_lut.empty()) {
+		ApplyPointwiseStage(*grayscale, defer_lut);
+		for (auto plane : chroma_planes) ApplyPointwiseStage(*plane, defer_lut);
+	}
+
+	if (cfg.standardize) {
+		preprocessing::Standardize(*grayscale);
+		for (auto plane : chroma_planes) preprocessing::Standardize(*plane);
+	}
+
+	if (cfg.lcn_window > 0) {
+		preprocessing::LocalContrastNormalize(*grayscale, cfg.lcn_window);
+		for (auto plane : chroma_planes) preprocessing::LocalContrastNormalize(*plane, cfg.lcn_window);
+	}
 	
 	return make_tuple(move(grayscale), move(color));
 }
 
+/**
+ * 8-bit planes go through the composed look-up table (or are left for formatting when defer_lut is set),
+ * fixed-point and native 16-bit planes through the 16-bit table, other types are processed operation by operation.
+ */
+void Image::ApplyPointwiseStage(Mat& plane, bool defer_lut) const
+{
+	if (plane.type() == CV_8U) {
+		if (!defer_lut) preprocessing::ApplyLut(plane, pointwise_lut);
+		return;
+	}
+	if (!pointwise_lut_16.empty() && plane.type() == pointwise_lut_16.type()) {
+		preprocessing::ApplyLut(plane, pointwise_lut_16);
+		return;
+	}
+	if (cfg.negative) preprocessing::ConvertToNegative(plane);
+	preprocessing::ApplyPointwise(plane, cfg.pointwise_ops);
+}
+
 /**
  * Processes image and transforms 2-D Mat into 1-D Mat.
  */
@@ -127,21 +204,63 @@ shared_ptr<Mat> Image::PcaPrepare()
 }
 
 
+/**
+ * Color images (unless pca_luma input is chosen) give the planar formatted values, so the components capture the color too.
+ */
+Mat Image::PcaRow(vector<int>* plane_sizes) const
+{
+	unique_ptr<Mat> grayscale;
+	unique_ptr<Chrominances> color;
+	if (cfg.format != CV_LOAD_IMAGE_COLOR || cfg.pca_options.input == pca_luma) {
+		tie(grayscale, color) = Process();
+		if (plane_sizes) *plane_sizes = { static_cast<int>(grayscale->total()) };
+		return grayscale->reshape(1, 1);
+	}
+
+	const bool fold_lut = CanFoldLut();
+	tie(grayscale, color) = Process(fold_lut);
+	vector<float> data;
+	const vector<int> sizes = FormatPlanes(*grayscale, color.get(), data, fold_lut, true);
+	if (plane_sizes) *plane_sizes = sizes;
+	return Mat(data, true).reshape(1, 1);
+}
+
+/**
+ * Dataset normalization (if chosen in cfg) is applied to the formatted data.
+ */
 shared_ptr<vector<float>> Image::ProcesssAndFormatData()
 {
 	if (formatted == nullptr) {
-		formatted = make_shared<vector<float>>();
-		unique_ptr<Mat> grayscale;
-		unique_ptr<Chrominances> color;
-		tie(grayscale, color) = Process();
-		
-		FormatDataForNn(move(grayscale), move(color));
+		formatted = make_shared<vector<float>>(ProcessAndFormatUnnormalized(channel_sizes));
+
+		if (cfg.normalization != no_normalization) {
+			if (!cfg.statistics) throw runtime_error("ProcesssAndFormatData: dataset statistics required for normalization were not calculated");
+			cfg.statistics->Normalize(*formatted, cfg.normalization);
+		}
 	}
 
 	return formatted;
 
 }
 
+vector<float> Image::ProcessAndFormatUnnormalized(vector<int>& channel_sizes) const
+{
+	unique_ptr<Mat> grayscale;
+	unique_ptr<Chrominances> color;
+	const bool fold_lut = CanFoldLut();
+	tie(grayscale, color) = Process(fold_lut);
+
+	vector<float> data;
+	channel_sizes = FormatPlanes(*grayscale, color.get(), data, fold_lut);
+	return data;
+}
+
+void Image::FormatProjection(const Mat& projection)
+{
+	formatted = make_shared<vector<float>>();
+	FormatDataForNn(make_unique<Mat>(projection), nullptr);
+}
+
 /**
  * Overloaded function used when pca is included.
  */
@@ -149,7 +268,7 @@ shared_ptr<vector<float>> Image::ProcesssAndFormatData(PCA& pca_vector)
 {
 	if (formatted == nullptr) {
 		formatted = make_shared<vector<float>>();
-		Mat point = pca_vector.project((*processed).reshape(1,1));
+		Mat point = pca_vector.project(processed ? (*processed).reshape(1, 1) : PcaRow());
 		FormatDataForNn(make_unique<Mat>(point), nullptr);
 	}
 	return formatted;
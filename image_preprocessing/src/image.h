@@ -7,6 +7,9 @@
 
 #include<memory>
 #include "preprocessing_functions.h"
+#include "dataset_statistics.h"
+#include "formatting.h"
+#include "pca_engine.h"
 #include<string>
 #include <opencv2/core/core.hpp>
 #include <tuple>
@@ -30,8 +33,11 @@ struct ProcessingConfiguration {
 	 * @param mean subtracting mean flag
 	 * @param negative converting to negative flag
 	 * @param pca pca flag
+	 * @param chroma chrominance processing flag - applies the processing chain also to the decimated chrominances (color format only)
+	 * @param chroma_filter_types vector of filter types for the chrominances (empty - the same as filter_types)
 	 */
-	ProcessingConfiguration(int format, bool filter, std::vector<FilterType> filter_types, bool mean, bool negative, bool pca);
+	ProcessingConfiguration(int format, bool filter, std::vector<FilterType> filter_types, bool mean, bool negative, bool pca,
+		bool chroma = false, std::vector<FilterType> chroma_filter_types = {});
 
 	int format;
 	bool filter;
@@ -39,6 +45,19 @@ struct ProcessingConfiguration {
 	bool mean;
 	bool negative;
 	bool pca;
+	bool chroma;
+	std::vector<FilterType> chroma_filter_types;
+	std::vector<PointwiseOperation> pointwise_ops; /**< Pointwise operations applied after the negative (composed into one look-up table for 8-bit images) */
+	bool standardize; /**< Per-image standardization (after negative) */
+	int lcn_window; /**< Local contrast normalization window size (0 - disabled), applied after standardization */
+	PcaOptions pca_options; /**< Pca solver and its parameters */
+	int random_projection; /**< Number of values of the sparse random projection used instead of pca (0 - disabled) */
+	uint64_t projection_seed; /**< Seed of the sparse random projection matrix */
+	bool native_depth; /**< Reading images with their native bit depth (16-bit images are processed as CV_16U) */
+	bool fixed_point; /**< Processing in fixed point (CV_16S, see preprocessing::fixed_point_bits) instead of 8 bits - no intermediate rounding to 8 bits */
+	OutputLayout layout; /**< Layout of formatted data */
+	NormalizationType normalization; /**< Dataset normalization applied to formatted data (requires statistics) */
+	std::shared_ptr<const DatasetStatistics> statistics; /**< Dataset statistics used for normalization */
 };
 
 /**
@@ -72,6 +91,14 @@ public:
 	 */
 	std::shared_ptr<cv::Mat> PcaPrepare();
 
+	/**
+	 * @brief Processing an image to a single row for primal components analysis (result is not cached).
+	 * @param plane_sizes vector to be filled with number of values of every plane in the row (may be nullptr)
+	 * @returns processed luminance (grayscale images or pca_luma input) or luminance followed by decimated chrominances
+	 * (color images, planar formatted values) as 1 x size Mat
+	 */
+	cv::Mat PcaRow(std::vector<int>* plane_sizes = nullptr) const;
+
 	/**
 	 * @brief Processing and formatting original image data according to processing configuration.
 	 * @returns processed data in the form of vector of floats
@@ -80,25 +107,58 @@ public:
 
 	/**
 	* @brief Processing and formatting original image data according to processing configuration (with pca analysis).
+	* Row prepared with PcaPrepare() is used if available, otherwise the image is processed again.
 	* @returns processed data in the form of vector of floats
 	*/
 	std::shared_ptr<std::vector<float>> ProcesssAndFormatData(cv::PCA& pca_vector);
+
+	/**
+	 * @brief Setting formatted data to a pca projection of the image computed outside (e.g. in a batch with other images).
+	 * @param projection projection of the image (1 x components, CV_32F)
+	 */
+	void FormatProjection(const cv::Mat& projection);
+
+	/**
+	 * @brief Processing and formatting original image data without dataset normalization (result is not cached).
+	 * @param channel_sizes vector to be filled with number of values in each channel of the formatted data
+	 * @returns processed data in the form of vector of floats
+	 */
+	std::vector<float> ProcessAndFormatUnnormalized(std::vector<int>& channel_sizes) const;
 	
 	auto GetOriginal() const { return *original; }
 	int GetSize() const { return static_cast<int>(original->total()); }
 	int GetLabel() const { return label; }
+	bool IsFormatted() const { return formatted != nullptr; }
+
+	/**
+	 * @brief Releasing the cached formatted data (the image is processed again when formatted data is needed).
+	 */
+	void ReleaseFormatted() { formatted.reset(); }
+
+	const std::vector<int>& GetChannelSizes() const { return channel_sizes; }
 
 private:
 	static ProcessingConfiguration cfg; 
+	static cv::Mat pointwise_lut; /**< Negative and pointwise operations from cfg composed into one 8-bit look-up table (empty if none) */
+	static std::vector<float> pointwise_float_lut; /**< pointwise_lut folded with the conversion to float used in formatting */
+	static cv::Mat pointwise_lut_16; /**< The same operations composed into a 16-bit look-up table for fixed-point or native 16-bit planes (empty if not used) */
 	std::unique_ptr<cv::Mat> original; /**< Original image */
 	std::shared_ptr<cv::Mat> processed; /**< Processed image ready for pca: 1-dimension Mat (memory allocation only if pca is chosen in cfg) */
 	std::shared_ptr<std::vector<float>> formatted; /**< Processed and formatted image data */
+	std::vector<int> channel_sizes; /**< Number of values in each channel of formatted data */
 	int label; /**< Image label/category */
 
 	/**
-	* @brief Formatting image matrix (cv::Mat) to vector of floats and saving it in member variable (formatted). 
+	* @brief Formatting grayscale image matrix and chrominances to vector of floats (in the layout from cfg) and appending them to the output vector.
+	* @param grayscale matrix (cv::Mat) with grayscale image
+	* @param color pointer to chrominances structure (nullptr for grayscale images)
+	* @param out output vector
+	* @param fold_lut flag for applying pointwise_lut during the conversion (planes processed with Process(true))
+	* @param force_planar flag for the planar layout regardless of the layout from cfg
+	* @returns number of values in each channel
 	*/
-	void FormatMatForNn(cv::Mat&) const;
+	std::vector<int> FormatPlanes(cv::Mat& grayscale, Chrominances* color, std::vector<float>& out, bool fold_lut = false,
+		bool force_planar = false) const;
 
 	/**
 	* @brief Formatting grayscale image matrix and chrominances to vector of floats and saving it in member variable (formatted).
@@ -109,9 +169,22 @@ private:
 
 	/**
 	* @brief Performing image processing according to configuration
+	* @param defer_lut flag for skipping the pointwise look-up table on 8-bit planes (it is then folded into formatting)
 	* @returns tuple with pointers to grayscale Mar and pointer to Chrominances structure (nullptr if color option is not chosen)
 	*/
-	std::tuple<std::unique_ptr<cv::Mat>,std::unique_ptr<Chrominances>> Process() const;
+	std::tuple<std::unique_ptr<cv::Mat>,std::unique_ptr<Chrominances>> Process(bool defer_lut = false) const;
+
+	/**
+	* @brief Applying the negative and pointwise operations from configuration to a single plane.
+	* @param plane image plane, modified in the function
+	* @param defer_lut flag for skipping the look-up table on CV_8U planes
+	*/
+	void ApplyPointwiseStage(cv::Mat& plane, bool defer_lut) const;
+
+	/**
+	* @brief Checking if the pointwise look-up table is the last processing stage and can be folded into formatting.
+	*/
+	static bool CanFoldLut();
 
 
 };
@@ -1,6 +1,7 @@
 #include "image.h"
 #include "preprocessing_functions.h"
 #include "data_loader.h"
+#include "dataset_reader.h"
 #include <tclap/CmdLine.h>
 #include <iostream>
 #include <fstream>
@@ -10,6 +11,67 @@
 #include <map>
 using namespace std;
 
+/**
+ * Parses a string of filter type characters (sobel(s)/gaussian(g)/median(m)), spaces are ignored.
+ */
+static vector<FilterType> ParseFilterTypes(string filter_t)
+{
+	filter_t.erase(std::remove(filter_t.begin(), filter_t.end(), ' '), filter_t.end());
+	vector<FilterType> filter_type;
+	for (auto f : filter_t) filter_type.push_back(static_cast<FilterType>(f));
+	return filter_type;
+}
+
+/**
+ * Parses comma separated pointwise operations: type character followed by parameters separated with ':'
+ * (negative(n)/gamma(g)<exponent>/contrast stretch(c)<low>:<high>/clamp(l)<low>:<high>/threshold(t)<value>), e.g. "g0.5,c0.1:0.9".
+ */
+static vector<PointwiseOperation> ParsePointwiseOperations(const string& operations_t)
+{
+	vector<PointwiseOperation> operations;
+	stringstream operations_stream(operations_t);
+	string item;
+	while (getline(operations_stream, item, ',')) {
+		item.erase(std::remove(item.begin(), item.end(), ' '), item.end());
+		if (item.empty()) continue;
+		PointwiseOperation operation = { static_cast<PointwiseType>(item[0]), 0, 0 };
+		const auto separator = item.find(':');
+		if (item.size() > 1) operation.param1 = stod(item.substr(1, separator - 1));
+		if (separator != string::npos) operation.param2 = stod(item.substr(separator + 1));
+		operations.push_back(operation);
+	}
+	return operations;
+}
+
+/**
+ * Returns the first character of an enum option, throws a usage error if it is not one of the allowed characters.
+ */
+static char ParseOptionCharacter(const TCLAP::ValueArg<std::string>& arg, const string& allowed)
+{
+	const string& value = arg.getValue();
+	if (value.empty() || allowed.find(value[0]) == string::npos)
+		throw TCLAP::ArgException("Invalid value '" + value + "', expected one of: " + allowed, arg.longID());
+	return value[0];
+}
+
+/**
+ * Returns the value of an integer option, throws a usage error if it is not an integer of at least min_value.
+ */
+static int ParseOptionInt(const TCLAP::ValueArg<std::string>& arg, int min_value)
+{
+	const string& value = arg.getValue();
+	size_t length = 0;
+	int result = 0;
+	try {
+		result = stoi(value, &length);
+	}
+	catch (logic_error&) {
+		length = 0;
+	}
+	if (length == 0 || length != value.size() || result < min_value)
+		throw TCLAP::ArgException("Invalid value '" + value + "', expected an integer not less than " + to_string(min_value), arg.longID());
+	return result;
+}
 
 int main(int argc, char** argv)
 {
@@ -22,23 +84,76 @@ int main(int argc, char** argv)
 		TCLAP::ValueArg<std::string> num_labels("l", "labels", "Number of type of labels (categories)", true, "", "int");
 		
 		TCLAP::ValueArg<std::string> filters("f", "filter", "Name of filters to be applied (sobel(s)/gaussian(g)/median(m))", false, "", "string");
+		TCLAP::ValueArg<std::string> chroma_filters("", "chroma-filter", "Name of filters to be applied to the chrominances, if different than --filter (sobel(s)/gaussian(g)/median(m))", false, "", "string");
 
-		TCLAP::ValueArg<std::string> pca_type("p", "pca", "Type of pca analysis", false, "", "string");
+		TCLAP::ValueArg<std::string> pca_type("p", "pca", "Type of pca analysis - solver (auto(a)/covariance(c)/gram(g)/randomized(r)/out-of-core(o)), any other value enables pca with the auto solver", false, "", "string");
 		TCLAP::ValueArg<std::string> pca_components("e", "components", "Max number of pca components", false, "", "int");
 		TCLAP::ValueArg<std::string> pca_variance("v", "variance", "Pca reatained variance", false, "", "double");
 		TCLAP::ValueArg<std::string> s_path("s", "save", "Save path", true, "", "string");
+		TCLAP::ValueArg<std::string> pointwise("", "pointwise", "Pointwise operations applied after negative, comma separated (gamma(g)<exp>/contrast(c)<low>:<high>/clamp(l)<low>:<high>/threshold(t)<value>/negative(n))", false, "", "string");
+		TCLAP::ValueArg<std::string> pca_oversampling("", "pca-oversampling", "Number of additional random vectors of the randomized pca solver", false, "", "int");
+		TCLAP::ValueArg<std::string> pca_power_iterations("", "pca-power-iterations", "Number of power iterations of the randomized pca solver", false, "", "int");
+		TCLAP::ValueArg<std::string> pca_fit_samples("", "pca-fit-samples", "Number of images the pca is fitted on (random sample, all the images are projected)", false, "", "int");
+		TCLAP::ValueArg<std::string> pca_input("", "pca-input", "Planes of color images used by the pca (luma(l)/joint(j)/per-plane(p)), joint by default", false, "", "string");
+		TCLAP::ValueArg<std::string> pca_whitening("", "pca-whitening", "Whitening of pca projections (none(n)/pca(p)/zca(z)), stored in the saved pca model", false, "", "string");
+		TCLAP::ValueArg<std::string> pca_whitening_epsilon("", "pca-whitening-epsilon", "Value added to the eigenvalues before whitening", false, "", "double");
+		TCLAP::ValueArg<std::string> pca_scratch("", "pca-scratch", "Directory of the scratch file of the out-of-core pca solver (system temporary directory by default)", false, "", "string");
+		TCLAP::ValueArg<std::string> random_projection("", "random-projection", "Number of values of the sparse random projection (used instead of pca, no fitting)", false, "", "int");
+		TCLAP::ValueArg<std::string> projection_seed("", "projection-seed", "Seed of the sparse random projection matrix", false, "", "int");
+		TCLAP::ValueArg<std::string> save_pca_path("", "save-pca", "Path where the pca model should be saved (for projecting other datasets with --load-pca)", false, "", "string");
+		TCLAP::ValueArg<std::string> load_pca_path("", "load-pca", "Path to the pca model saved with --save-pca (used instead of calculating pca)", false, "", "string");
+		TCLAP::ValueArg<std::string> lcn_window("", "lcn", "Local contrast normalization window size (odd)", false, "", "int");
+		TCLAP::ValueArg<std::string> layout("", "layout", "Layout of formatted data (planar(p)/nchw(c)/nhwc(h)), nchw and nhwc upsample chrominances", false, "", "string");
+		TCLAP::ValueArg<std::string> format_version("", "format-version", "Version of the saved file format (1 - original format, default; 2 - aligned with header)", false, "", "int");
+		TCLAP::ValueArg<std::string> write_batch("", "write-batch", "Number of images processed and written at once, memory does not grow with the number of images (0 - all the images kept in memory)", false, "", "int");
+		TCLAP::ValueArg<std::string> shards("", "shards", "Number of files the images are split into (listed in <save path>.index)", false, "", "int");
+		TCLAP::ValueArg<std::string> shard_size("", "shard-size", "Number of images in a file of sharded output (instead of --shards)", false, "", "int");
+		TCLAP::ValueArg<std::string> dtype("", "dtype", "Data type of saved values (float32(f)/float16(h)/bfloat16(b)/quantized uint8(u)/quantized int8(i))", false, "", "string");
+		TCLAP::ValueArg<std::string> normalization_type("", "normalize", "Dataset normalization (mean image(i)/channel mean and std(c))", false, "", "string");
+		TCLAP::ValueArg<std::string> stats_path("", "stats", "Path to dataset statistics saved with a previous run (used instead of calculating them)", false, "", "string");
 
 		cmd.add(i_path);
 		cmd.add(num_labels);
 		cmd.add(filters);
+		cmd.add(chroma_filters);
 		cmd.add(pca_type);
 		cmd.add(pca_components);
 		cmd.add(pca_variance);
+		cmd.add(pca_oversampling);
+		cmd.add(pca_power_iterations);
+		cmd.add(pca_fit_samples);
+		cmd.add(pca_input);
+		cmd.add(pca_whitening);
+		cmd.add(pca_whitening_epsilon);
+		cmd.add(pca_scratch);
+		cmd.add(random_projection);
+		cmd.add(projection_seed);
+		cmd.add(save_pca_path);
+		cmd.add(load_pca_path);
 		cmd.add(s_path);
+		cmd.add(pointwise);
+		cmd.add(lcn_window);
+		cmd.add(layout);
+		cmd.add(dtype);
+		cmd.add(format_version);
+		cmd.add(write_batch);
+		cmd.add(shards);
+		cmd.add(shard_size);
+		cmd.add(normalization_type);
+		cmd.add(stats_path);
 
 		TCLAP::SwitchArg negative_switch("n", "negative", "Change the image to negative", cmd, false);
 		TCLAP::SwitchArg mean_switch("m", "mean", "Subtract mean", cmd, false);
 		TCLAP::SwitchArg color_switch("c", "color", "Read data as color images", cmd, false);
+		TCLAP::SwitchArg standardize_switch("z", "standardize", "Standardize every image (subtract mean, divide by std)", cmd, false);
+		TCLAP::SwitchArg per_channel_switch("", "per-channel", "Separate quantization scale and zero point for every channel", cmd, false);
+		TCLAP::SwitchArg chroma_switch("u", "chroma", "Apply the processing to the chrominances too (color images only)", cmd, false);
+		TCLAP::SwitchArg pca_stratified_switch("", "pca-stratified", "Sample images for the pca fit proportionally to the number of images in every category", cmd, false);
+		TCLAP::SwitchArg native_depth_switch("", "native-depth", "Read images with their native bit depth (16-bit PNG/TIFF processed without truncation to 8 bits)", cmd, false);
+		TCLAP::SwitchArg direct_io_switch("", "direct-io", "Write the output file without the system file cache (unbuffered writes)", cmd, false);
+		TCLAP::SwitchArg parallel_write_switch("", "parallel-write", "Write records from all the processing threads at precomputed offsets (requires --format-version 2)", cmd, false);
+		TCLAP::SwitchArg balanced_shards_switch("", "balanced-shards", "Split images of every category evenly between the shards", cmd, false);
+		TCLAP::SwitchArg fixed_point_switch("", "fixed-point", "Process images in 16-bit fixed point (no rounding to 8 bits between the operations)", cmd, false);
 
 		cmd.parse(argc, argv);
 
@@ -49,29 +164,99 @@ int main(int argc, char** argv)
 		string filter_t = filters.getValue();
 		bool mean = mean_switch.getValue();
 		bool negative = negative_switch.getValue();
-		bool pca = !pca_type.getValue().empty();
+		bool pca = !pca_type.getValue().empty() || !load_pca_path.getValue().empty();
 		bool save = !s_path.getValue().empty();
 		string save_path = s_path.getValue();
 		bool color = color_switch.getValue();
+		bool chroma = chroma_switch.getValue();
 
 		int type = (color) ? CV_LOAD_IMAGE_COLOR : CV_LOAD_IMAGE_GRAYSCALE;
 		
-		filter_t.erase(std::remove(filter_t.begin(), filter_t.end(), ' '), filter_t.end());
-		vector<char> filter_vector(filter_t.begin(), filter_t.end());
-		vector<FilterType> filter_type;
+		vector<FilterType> filter_type = ParseFilterTypes(filter_t);
+		vector<FilterType> chroma_filter_type = ParseFilterTypes(chroma_filters.getValue());
+		if (!chroma_filter_type.empty()) filter = chroma = true;
+
+		ProcessingConfiguration cfg(type, filter, filter_type, mean, negative, pca, chroma, chroma_filter_type);
+		cfg.pointwise_ops = ParsePointwiseOperations(pointwise.getValue());
+		cfg.standardize = standardize_switch.getValue();
+		if (!pca_type.getValue().empty()) {
+			const string solvers = "acgro";
+			const char solver = pca_type.getValue()[0];
+			if (solvers.find(solver) != string::npos) cfg.pca_options.solver = static_cast<PcaSolver>(solver);
+			else {
+				cerr << "Unknown pca solver '" << pca_type.getValue() << "', using the auto solver" << endl;
+				cfg.pca_options.solver = pca_auto;
+			}
+		}
+		if (!pca_variance.getValue().empty()) {
+			cfg.pca_options.retained_variance = stod(pca_variance.getValue());
+			cfg.pca_options.components = 0;
+		}
+		if (!pca_components.getValue().empty()) cfg.pca_options.components = stoi(pca_components.getValue());
+		if (!pca_oversampling.getValue().empty()) cfg.pca_options.oversampling = stoi(pca_oversampling.getValue());
+		if (!pca_power_iterations.getValue().empty()) cfg.pca_options.power_iterations = stoi(pca_power_iterations.getValue());
+		if (!pca_fit_samples.getValue().empty()) cfg.pca_options.fit_samples = stoi(pca_fit_samples.getValue());
+		cfg.pca_options.stratified = pca_stratified_switch.getValue();
+		cfg.pca_options.scratch_directory = pca_scratch.getValue();
+		if (!random_projection.getValue().empty()) cfg.random_projection = stoi(random_projection.getValue());
+		if (!projection_seed.getValue().empty()) cfg.projection_seed = stoull(projection_seed.getValue());
+		if (!pca_input.getValue().empty()) cfg.pca_options.input = static_cast<PcaInput>(ParseOptionCharacter(pca_input, "ljp"));
+		if (!pca_whitening.getValue().empty()) cfg.pca_options.whitening = static_cast<PcaWhitening>(ParseOptionCharacter(pca_whitening, "npz"));
+		if (!pca_whitening_epsilon.getValue().empty()) cfg.pca_options.whitening_epsilon = stod(pca_whitening_epsilon.getValue());
+		cfg.native_depth = native_depth_switch.getValue();
+		cfg.fixed_point = fixed_point_switch.getValue();
+		if (!lcn_window.getValue().empty()) {
+			cfg.lcn_window = ParseOptionInt(lcn_window, 1);
+			if (cfg.lcn_window % 2 == 0) throw TCLAP::ArgException("Local contrast normalization window size must be odd", lcn_window.longID());
+		}
+		if (!layout.getValue().empty()) cfg.layout = static_cast<OutputLayout>(ParseOptionCharacter(layout, "pch"));
+		if (!normalization_type.getValue().empty()) cfg.normalization = static_cast<NormalizationType>(ParseOptionCharacter(normalization_type, "ic"));
+		if (!stats_path.getValue().empty()) cfg.statistics = make_shared<DatasetStatistics>(DatasetStatistics::Load(stats_path.getValue()));
+		OutputConfiguration out_cfg;
+		if (!dtype.getValue().empty()) out_cfg.dtype = static_cast<DataType>(ParseOptionCharacter(dtype, "fhbui"));
+		out_cfg.per_channel_quantization = per_channel_switch.getValue();
+		out_cfg.direct_io = direct_io_switch.getValue();
+		out_cfg.parallel_write = parallel_write_switch.getValue();
+		if (!format_version.getValue().empty()) {
+			out_cfg.format_version = ParseOptionInt(format_version, 1);
+			if (out_cfg.format_version > dataset_file::format_version) throw TCLAP::ArgException("Unknown file format version", format_version.longID());
+		}
+		if (!write_batch.getValue().empty()) out_cfg.batch_size = ParseOptionInt(write_batch, 0);
+		if (!shards.getValue().empty()) out_cfg.shards = ParseOptionInt(shards, 1);
+		if (!shard_size.getValue().empty()) out_cfg.shard_size = ParseOptionInt(shard_size, 1);
+		out_cfg.balanced_shards = balanced_shards_switch.getValue();
 
-		for (auto f : filter_vector) filter_type.push_back(static_cast<FilterType>(f));
+		if (out_cfg.parallel_write && out_cfg.format_version == 1) {
+			throw TCLAP::ArgException("Parallel writes require --format-version 2", parallel_write_switch.longID());
+		}
+		if (out_cfg.shards > 1 && out_cfg.shard_size > 0) {
+			throw TCLAP::ArgException("Number of shards and shard size cannot be used together", shard_size.longID());
+		}
+		if (!save_pca_path.getValue().empty() && !pca) {
+			throw TCLAP::ArgException("Pca model can be saved only with pca enabled (-p or --load-pca)", save_pca_path.longID());
+		}
 
-		ProcessingConfiguration cfg(type, filter, filter_type, mean, negative, pca);
 		DataLoader data_loader(input_path, num_categories, cfg);
+		if (!load_pca_path.getValue().empty()) data_loader.LoadPcaModel(load_pca_path.getValue());
 		data_loader.ReadData();
+		if (!save_pca_path.getValue().empty()) data_loader.SavePcaModel(save_pca_path.getValue());
 		cerr << "Data was read succesfully" << endl;
-		if (save) data_loader.SaveFormattedData(save_path);
-		vector<vector<float>> test;
-		vector<int> labels;
-		DataLoader::ReadVector(save_path, test, labels);
-		if (test.size() != data_loader.GetNumImages()) throw exception("Saving went wrong");
-		if (labels.size() != data_loader.GetNumImages()) throw exception("Saving went wrong");
+		if (save) data_loader.SaveFormattedData(save_path, out_cfg);
+		if (out_cfg.shards > 1 || out_cfg.shard_size > 0) {
+			int64_t num_records = 0;
+			for (auto& shard : dataset_file::ReadShardIndex(save_path + ".index")) {
+				if (DatasetReader(shard.path).GetNumRecords() != shard.num_records) throw exception("Saving went wrong");
+				num_records += shard.num_records;
+			}
+			if (num_records != data_loader.GetNumImages()) throw exception("Saving went wrong");
+		}
+		else {
+			vector<vector<float>> test;
+			vector<int> labels;
+			DataLoader::ReadVector(save_path, test, labels);
+			if (test.size() != data_loader.GetNumImages()) throw exception("Saving went wrong");
+			if (labels.size() != data_loader.GetNumImages()) throw exception("Saving went wrong");
+		}
 		cout << "Data was saved to a file successfully" << endl;
 	}
 	catch (TCLAP::ArgException &e)  // catch any exceptions
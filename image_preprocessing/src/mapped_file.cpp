@@ -0,0 +1,64 @@
+/**
+* @file mapped_file.cpp
+* @brief Implementation of MappedFile class (Windows file mapping).
+*/
+
+#include "mapped_file.h"
+#include <stdexcept>
+#include <algorithm>
+
+using namespace std;
+
+/**
+ * Throws an invalid argument error when the file cannot be opened and a runtime error when it cannot be mapped.
+ * Empty files are not mapped (GetData() returns nullptr).
+ */
+MappedFile::MappedFile(const string& path) : path(path), file(INVALID_HANDLE_VALUE), mapping(nullptr), data(nullptr), size(0)
+{
+	file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) throw invalid_argument("MappedFile: Invalid path: " + path + " , file could not be opened");
+
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(file, &file_size)) {
+		Close();
+		throw runtime_error("MappedFile: size of the file could not be read: " + path);
+	}
+	size = static_cast<size_t>(file_size.QuadPart);
+	if (size == 0) return;
+
+	mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping) data = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+	if (!data) {
+		Close();
+		throw runtime_error("MappedFile: file could not be mapped: " + path);
+	}
+}
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+/**
+ * PrefetchVirtualMemory (Windows 8 and later) only queues the reads, older systems read the pages on first access.
+ */
+void MappedFile::Prefetch(size_t offset, size_t length) const
+{
+	if (!data || offset >= size) return;
+#if defined(_WIN32_WINNT_WIN8) && _WIN32_WINNT >= _WIN32_WINNT_WIN8
+	WIN32_MEMORY_RANGE_ENTRY range;
+	range.VirtualAddress = const_cast<char*>(data) + offset;
+	range.NumberOfBytes = min(length, size - offset);
+	PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#endif
+}
+
+void MappedFile::Close()
+{
+	if (data) UnmapViewOfFile(data);
+	if (mapping) CloseHandle(mapping);
+	if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+	data = nullptr;
+	mapping = nullptr;
+	file = INVALID_HANDLE_VALUE;
+}
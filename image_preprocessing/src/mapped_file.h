@@ -0,0 +1,55 @@
+/**
+* @file mapped_file.h
+* @brief Read-only memory mapped file (MappedFile class).
+*/
+
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <string>
+#include <cstddef>
+#include <Windows.h>
+
+/**
+ * @brief Read-only view of a whole file mapped into memory.
+ * Pages are read from the file on first access and shared with the system file cache (no copy in the process memory).
+ */
+class MappedFile {
+
+public:
+	/**
+	 * @brief MappedFile constructor - opening and mapping the file.
+	 * @param path path to the file
+	 */
+	explicit MappedFile(const std::string& path);
+
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	/**
+	 * @brief Requesting pages of a part of the file in the background (read-ahead, pages are not locked).
+	 * @param offset offset of the part in bytes
+	 * @param length length of the part in bytes
+	 */
+	void Prefetch(size_t offset, size_t length) const;
+
+	const char* GetData() const { return data; }
+	size_t GetSize() const { return size; }
+	const std::string& GetPath() const { return path; }
+
+private:
+	std::string path; /**< Path to the file */
+	HANDLE file; /**< File handle */
+	HANDLE mapping; /**< File mapping handle */
+	const char* data; /**< Pointer to the mapped view */
+	size_t size; /**< Size of the file in bytes */
+
+	/**
+	 * @brief Unmapping the view and closing the handles.
+	 */
+	void Close();
+};
+
+#endif // !MAPPED_FILE_H
@@ -0,0 +1,183 @@
+/**
+* @file output_file.cpp
+* @brief Implementation of OutputFile class (double-buffered overlapped writes).
+*/
+
+#include "output_file.h"
+#include <stdexcept>
+#include <cstring>
+
+using namespace std;
+
+namespace
+{
+	double SecondsSince(chrono::steady_clock::time_point start)
+	{
+		return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	}
+}
+
+/**
+ * Buffers are allocated with VirtualAlloc (page-aligned, as unbuffered writes require).
+ * Throws an invalid argument error when the file cannot be created and a runtime error when the buffers cannot be allocated.
+ */
+OutputFile::OutputFile(const string& path, bool direct, size_t buffer_size) : path(path), file(INVALID_HANDLE_VALUE), direct(direct),
+	buffer_size((buffer_size + sector_size - 1) / sector_size * sector_size), current(0), filled(0), position(0), submitted(0),
+	seconds(0), wait_seconds(0)
+{
+	if (this->buffer_size == 0) throw invalid_argument("OutputFile: buffer size must be positive");
+	for (int i = 0; i < 2; i++) {
+		buffers[i] = nullptr;
+		pending[i] = false;
+		memset(&requests[i], 0, sizeof(requests[i]));
+	}
+
+	const DWORD flags = FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED | (direct ? FILE_FLAG_NO_BUFFERING : 0);
+	file = CreateFileA(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, flags, nullptr);
+	if (file == INVALID_HANDLE_VALUE) throw invalid_argument("OutputFile: file could not be opened: " + path);
+
+	for (int i = 0; i < 2; i++) {
+		buffers[i] = static_cast<char*>(VirtualAlloc(nullptr, this->buffer_size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+		requests[i].hEvent = CreateEventA(nullptr, TRUE, FALSE, nullptr);
+		if (!buffers[i] || !requests[i].hEvent) {
+			Release();
+			throw runtime_error("OutputFile: write buffers could not be allocated (" + to_string(this->buffer_size) + " bytes)");
+		}
+	}
+}
+
+OutputFile::~OutputFile()
+{
+	Release();
+}
+
+void OutputFile::Write(const void* data, size_t size)
+{
+	if (file == INVALID_HANDLE_VALUE) throw runtime_error("OutputFile: writing to a closed file: " + path);
+	const char* src = static_cast<const char*>(data);
+	while (size > 0) {
+		const size_t count = (size < buffer_size - filled) ? size : buffer_size - filled;
+		memcpy(buffers[current] + filled, src, count);
+		filled += count;
+		src += count;
+		size -= count;
+		position += count;
+		if (filled == buffer_size) Submit();
+	}
+}
+
+int64_t OutputFile::Pad(int64_t alignment)
+{
+	static const char zeros[64] = {};
+	while (position % alignment != 0) {
+		const int64_t count = alignment - position % alignment;
+		Write(zeros, static_cast<size_t>((count < 64) ? count : 64));
+	}
+	return position;
+}
+
+void OutputFile::Rewrite(int64_t offset, const void* data, size_t size)
+{
+	if (offset < 0 || offset + static_cast<int64_t>(size) > position) throw invalid_argument("Rewrite: only written data can be overwritten");
+	const char* src = static_cast<const char*>(data);
+	rewrites.emplace_back(offset, vector<char>(src, src + size));
+}
+
+/**
+ * Unbuffered writes must have sector-aligned sizes, so the last buffer is padded with zeros and the file is truncated
+ * to its real size after all the writes finish. Rewrites are applied through a new (buffered) handle.
+ */
+void OutputFile::Close()
+{
+	if (file == INVALID_HANDLE_VALUE) return;
+	if (filled > 0) Submit();
+	Wait(0);
+	Wait(1);
+	const auto close_start = chrono::steady_clock::now();
+
+	if (direct) {
+		FILE_END_OF_FILE_INFO end_of_file;
+		end_of_file.EndOfFile.QuadPart = position;
+		if (!SetFileInformationByHandle(file, FileEndOfFileInfo, &end_of_file, sizeof(end_of_file))) {
+			Release();
+			throw runtime_error("OutputFile: file could not be truncated: " + path);
+		}
+	}
+	Release();
+
+	if (!rewrites.empty()) {
+		HANDLE handle = CreateFileA(path.c_str(), GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (handle == INVALID_HANDLE_VALUE) throw runtime_error("OutputFile: file could not be reopened: " + path);
+		bool success = true;
+		for (auto& rewrite : rewrites) {
+			LARGE_INTEGER offset;
+			offset.QuadPart = rewrite.first;
+			DWORD written = 0;
+			success = success && SetFilePointerEx(handle, offset, nullptr, FILE_BEGIN) &&
+				WriteFile(handle, rewrite.second.data(), static_cast<DWORD>(rewrite.second.size()), &written, nullptr) &&
+				written == rewrite.second.size();
+		}
+		CloseHandle(handle);
+		rewrites.clear();
+		if (!success) throw runtime_error("OutputFile: writing the file failed: " + path);
+	}
+	seconds += SecondsSince(close_start);
+}
+
+/**
+ * Buffers are written at consecutive offsets given in the OVERLAPPED structure (the handle has no file pointer).
+ */
+void OutputFile::Submit()
+{
+	size_t size = filled;
+	if (direct && size % sector_size != 0) {
+		const size_t padded = (size + sector_size - 1) / sector_size * sector_size;
+		memset(buffers[current] + size, 0, padded - size);
+		size = padded;
+	}
+
+	OVERLAPPED& request = requests[current];
+	ResetEvent(request.hEvent);
+	request.Offset = static_cast<DWORD>(submitted & 0xFFFFFFFF);
+	request.OffsetHigh = static_cast<DWORD>(submitted >> 32);
+	const auto submit_start = chrono::steady_clock::now();
+	const BOOL success = WriteFile(file, buffers[current], static_cast<DWORD>(size), nullptr, &request) || GetLastError() == ERROR_IO_PENDING;
+	seconds += SecondsSince(submit_start);
+	if (!success) throw runtime_error("OutputFile: writing the file failed: " + path);
+	pending[current] = true;
+	submitted += filled;
+
+	current = 1 - current;
+	filled = 0;
+	Wait(current);
+}
+
+void OutputFile::Wait(int index)
+{
+	if (!pending[index]) return;
+	const auto wait_start = chrono::steady_clock::now();
+	DWORD written = 0;
+	const BOOL success = GetOverlappedResult(file, &requests[index], &written, TRUE);
+	pending[index] = false;
+	const double waited = SecondsSince(wait_start);
+	wait_seconds += waited;
+	seconds += waited;
+	if (!success) throw runtime_error("OutputFile: writing the file failed: " + path);
+}
+
+void OutputFile::Release()
+{
+	for (int i = 0; i < 2; i++) {
+		if (pending[i]) {
+			DWORD written = 0;
+			GetOverlappedResult(file, &requests[i], &written, TRUE);
+			pending[i] = false;
+		}
+		if (buffers[i]) VirtualFree(buffers[i], 0, MEM_RELEASE);
+		if (requests[i].hEvent) CloseHandle(requests[i].hEvent);
+		buffers[i] = nullptr;
+		requests[i].hEvent = nullptr;
+	}
+	if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+	file = INVALID_HANDLE_VALUE;
+}
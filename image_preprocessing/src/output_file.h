@@ -0,0 +1,111 @@
+/**
+* @file output_file.h
+* @brief Buffered output file with asynchronous writes (OutputFile class).
+*/
+
+#ifndef OUTPUT_FILE_H
+#define OUTPUT_FILE_H
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <Windows.h>
+
+/**
+ * @brief Sequential output file written in large blocks.
+ * Data is copied to one of two page-aligned buffers, a full buffer is written asynchronously (overlapped WriteFile)
+ * while the other one is filled, so copying and writing overlap and the disk gets a few large requests instead of many small ones.
+ * The file can be opened without the system file cache (FILE_FLAG_NO_BUFFERING) - data goes directly from the buffers to the disk.
+ */
+class OutputFile {
+
+public:
+	/**
+	 * @brief OutputFile constructor - creating (or truncating) the file and allocating the buffers.
+	 * @param path path to the file
+	 * @param direct flag for writing without the system file cache
+	 * @param buffer_size size of each of the two buffers in bytes (rounded up to a multiple of sector_size)
+	 */
+	explicit OutputFile(const std::string& path, bool direct = false, size_t buffer_size = default_buffer_size);
+
+	~OutputFile();
+
+	OutputFile(const OutputFile&) = delete;
+	OutputFile& operator=(const OutputFile&) = delete;
+
+	/**
+	 * @brief Appending data to the file.
+	 * @param data pointer to the data
+	 * @param size number of bytes
+	 */
+	void Write(const void* data, size_t size);
+
+	/**
+	 * @brief Appending zeros up to a multiple of the alignment.
+	 * @param alignment alignment in bytes
+	 * @returns position after the padding
+	 */
+	int64_t Pad(int64_t alignment);
+
+	/**
+	 * @brief Overwriting already written data (e.g. a header with final values), applied when the file is closed.
+	 * @param offset offset of the data in the file
+	 * @param data pointer to the data
+	 * @param size number of bytes
+	 */
+	void Rewrite(int64_t offset, const void* data, size_t size);
+
+	/**
+	 * @brief Writing the remaining data, waiting for all the writes and closing the file (throws a runtime error if any write failed).
+	 */
+	void Close();
+
+	int64_t GetPosition() const { return position; }
+	double GetSeconds() const { return seconds; }
+	double GetWaitSeconds() const { return wait_seconds; }
+
+	/**
+	 * @brief Average write speed in MB/s - bytes written divided by the time spent in write calls and waiting for writes
+	 * (processing between the writes is not counted).
+	 */
+	double GetThroughput() const { return (seconds > 0) ? position / (1024.0 * 1024.0) / seconds : 0; }
+
+	static const size_t default_buffer_size = 8 << 20; /**< Default size of a buffer (8 MB) */
+	static const size_t sector_size = 4096; /**< Alignment of unbuffered writes (covers 512 B and 4 kB sectors) */
+
+private:
+	std::string path; /**< Path to the file */
+	HANDLE file; /**< File handle (opened for overlapped writes) */
+	bool direct; /**< Flag for writing without the system file cache */
+	size_t buffer_size; /**< Size of each buffer in bytes */
+	char* buffers[2]; /**< Page-aligned buffers */
+	OVERLAPPED requests[2]; /**< Write requests of the buffers */
+	bool pending[2]; /**< Flags for buffers being written */
+	int current; /**< Index of the buffer being filled */
+	size_t filled; /**< Number of bytes in the current buffer */
+	int64_t position; /**< Number of bytes written to the file (including buffered ones) */
+	int64_t submitted; /**< Offset of the current buffer in the file */
+	std::vector<std::pair<int64_t, std::vector<char>>> rewrites; /**< Data overwritten when the file is closed */
+	double seconds; /**< Time spent in write calls, waiting for writes and finishing the file on closing */
+	double wait_seconds; /**< Time spent waiting for writes to finish (part of seconds) */
+
+	/**
+	 * @brief Starting an asynchronous write of the current buffer and switching to the other buffer (after its write finishes).
+	 */
+	void Submit();
+
+	/**
+	 * @brief Waiting for the write of a buffer to finish.
+	 */
+	void Wait(int index);
+
+	/**
+	 * @brief Waiting for the pending writes (ignoring errors), releasing the buffers and closing the handles.
+	 */
+	void Release();
+};
+
+#endif // !OUTPUT_FILE_H
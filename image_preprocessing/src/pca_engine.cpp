@@ -0,0 +1,949 @@
+/**
+* @file pca_engine.cpp
+* @brief PCA engine - implementation.
+*/
+
+#include "pca_engine.h"
+#include "preprocessing_functions.h"
+#include "mapped_file.h"
+#include "scratch_matrix.h"
+#include <stdexcept>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <fstream>
+#include <cstring>
+#include <random>
+#include <numeric>
+#include <map>
+
+using namespace std;
+using namespace cv;
+
+/**
+ * solver - pca_auto
+ * components - 100
+ * retained_variance - 0
+ * oversampling - 10
+ * power_iterations - 2
+ * seed - 0
+ * memory_budget - 2 GB
+ * fit_samples - 0
+ * stratified - false
+ * input - pca_joint
+ * scratch_directory - "" (system temporary directory)
+ * whitening - no_whitening
+ * whitening_epsilon - 1e-5
+ */
+PcaOptions::PcaOptions() : solver(pca_auto), components(100), retained_variance(0), oversampling(10), power_iterations(2), seed(0),
+	memory_budget(int64_t(2) << 30), fit_samples(0), stratified(false), input(pca_joint), scratch_directory(), whitening(no_whitening), whitening_epsilon(1e-5)
+{
+}
+
+/**
+ * solver - pca_auto
+ * captured_variance - 0
+ * total_variance - 0
+ */
+PcaReport::PcaReport() : solver(pca_auto), reason(), phase_seconds(), captured_variance(0), total_variance(0)
+{
+}
+
+namespace
+{
+	const int pass_batch_size = 64;
+
+	const char model_magic[4] = { 'P', 'P', 'C', 'A' };
+	const int32_t model_version = 1;
+	const int64_t model_alignment = 64;
+
+	/**
+	 * Header of the pca model file (64 bytes), offsets are counted from the beginning of the file.
+	 */
+	struct ModelHeader {
+		char magic[4];
+		int32_t version;
+		int32_t dim; /**< Number of values in a row */
+		int32_t components; /**< Number of components */
+		int64_t mean_offset; /**< Mean row (dim floats) */
+		int64_t eigenvalues_offset; /**< Eigenvalues (components floats) */
+		int64_t eigenvectors_offset; /**< Eigenvectors (components rows) */
+		int64_t eigenvectors_step; /**< Distance between eigenvector rows in bytes (multiple of the alignment) */
+		int32_t whitening; /**< PcaWhitening applied to the eigenvectors (0 - no whitening, files saved without whitening) */
+		float whitening_epsilon; /**< Value added to the eigenvalues in whitening */
+		int32_t num_eigenvalues; /**< Number of eigenvalues if different than number of eigenvector rows (zca), otherwise 0 */
+		char reserved[4];
+	};
+	static_assert(sizeof(ModelHeader) == 64, "pca model header must have 64 bytes");
+
+	int64_t Align(int64_t offset)
+	{
+		return (offset + model_alignment - 1) / model_alignment * model_alignment;
+	}
+
+	/**
+	 * Measuring time of consecutive phases of a fit, times are appended to the report (if any).
+	 */
+	class PhaseTimer {
+	public:
+		explicit PhaseTimer(PcaReport* report) : report(report), start(getTickCount()) {}
+
+		void Finish(const string& phase)
+		{
+			const int64 now = getTickCount();
+			if (report) report->phase_seconds.emplace_back(phase, (now - start) / getTickFrequency());
+			start = now;
+		}
+
+	private:
+		PcaReport* report;
+		int64 start;
+	};
+
+	/**
+	 * Number of components limited by the number of available components, max_components and retained variance.
+	 */
+	int NumComponents(const Mat& eigenvalues, int available, int max_components, double retained_variance, double total_variance = 0)
+	{
+		int num_components = available;
+		if (max_components > 0) num_components = min(num_components, max_components);
+		if (retained_variance > 0) {
+			num_components = min(num_components, pca_engine::ComponentsForVariance(eigenvalues, retained_variance, total_variance));
+		}
+		return max(num_components, 1);
+	}
+
+	/**
+	 * Filling first rows of a batch (CV_32F) with centered rows begin, begin + 1, ...
+	 */
+	void LoadCentered(const pca_engine::RowSource& rows, const Mat& mean, int begin, int count, Mat& batch)
+	{
+		for (int i = 0; i < count; i++) {
+			Mat batch_row = batch.row(i);
+			rows(begin + i).reshape(1, 1).convertTo(batch_row, CV_32F);
+			batch_row -= mean;
+		}
+	}
+
+	/**
+	 * Parallel pass calculating mean row (CV_32F) and total variance (sum of variances of all the dimensions).
+	 */
+	void MeanPass(int num_rows, const pca_engine::RowSource& rows, Mat& mean, double& total_variance)
+	{
+		Mat total_sum;
+		double total_squares = 0;
+		mutex total_mutex;
+
+		preprocessing::ParallelFor(Range(0, num_rows), [&](const Range& range) {
+			Mat sum_row, row_64f;
+			double squares = 0;
+			for (int i = range.start; i < range.end; i++) {
+				rows(i).reshape(1, 1).convertTo(row_64f, CV_64F);
+				if (sum_row.empty()) sum_row = Mat::zeros(row_64f.size(), CV_64F);
+				sum_row += row_64f;
+				squares += row_64f.dot(row_64f);
+			}
+			if (sum_row.empty()) return;
+
+			lock_guard<mutex> lock(total_mutex);
+			if (total_sum.empty()) total_sum = sum_row;
+			else total_sum += sum_row;
+			total_squares += squares;
+		}, getNumThreads());
+
+		Mat mean_64f = total_sum / num_rows;
+		total_variance = max(0.0, total_squares / num_rows - mean_64f.dot(mean_64f));
+		mean_64f.convertTo(mean, CV_32F);
+	}
+
+	/**
+	 * Parallel pass over centered rows X (in batches): product = X^T * X * basis (dim x l) and/or gram = (X * basis)^T * (X * basis) (l x l).
+	 * Every thread multiplies its batches with cv::gemm and keeps partial results, which are summed at the end.
+	 */
+	void ProjectedPass(int num_rows, const pca_engine::RowSource& rows, const Mat& mean, const Mat& basis, Mat* product, Mat* gram)
+	{
+		const int dim = basis.rows;
+		const int width = basis.cols;
+		if (product) *product = Mat::zeros(dim, width, CV_32F);
+		if (gram) *gram = Mat::zeros(width, width, CV_64F);
+		mutex total_mutex;
+
+		preprocessing::ParallelFor(Range(0, num_rows), [&](const Range& range) {
+			Mat batch(pass_batch_size, dim, CV_32F);
+			Mat partial_product = product ? Mat::zeros(dim, width, CV_32F) : Mat();
+			Mat partial_gram = gram ? Mat::zeros(width, width, CV_64F) : Mat();
+			Mat projected, batch_gram;
+
+			for (int begin = range.start; begin < range.end; begin += pass_batch_size) {
+				const int batch_rows = min(pass_batch_size, range.end - begin);
+				LoadCentered(rows, mean, begin, batch_rows, batch);
+				const Mat centered = batch.rowRange(0, batch_rows);
+				gemm(centered, basis, 1, noArray(), 0, projected);
+				if (product) gemm(centered, projected, 1, partial_product, 1, partial_product, GEMM_1_T);
+				if (gram) {
+					mulTransposed(projected, batch_gram, true, noArray(), 1, CV_64F);
+					partial_gram += batch_gram;
+				}
+			}
+
+			lock_guard<mutex> lock(total_mutex);
+			if (product) *product += partial_product;
+			if (gram) *gram += partial_gram;
+		}, getNumThreads());
+	}
+
+	/**
+	 * Orthonormal basis of the columns of a matrix (left singular vectors).
+	 */
+	Mat Orthonormalize(const Mat& columns)
+	{
+		Mat w, u, vt;
+		SVD::compute(columns, w, u, vt);
+		return u;
+	}
+}
+
+CovarianceAccumulator::CovarianceAccumulator(int dim, int batch_size) : dim(dim), count(0), batch_rows(0)
+{
+	if (dim <= 0 || batch_size <= 0) throw invalid_argument("CovarianceAccumulator: row size and batch size must be positive");
+	mean = Mat::zeros(1, dim, CV_64F);
+	scatter = Mat::zeros(dim, dim, CV_64F);
+	batch.create(batch_size, dim, CV_64F);
+}
+
+void CovarianceAccumulator::Add(const Mat& row)
+{
+	if (static_cast<int>(row.total()) != dim || row.channels() != 1) throw invalid_argument("CovarianceAccumulator: Inconsistent data size!");
+	Mat batch_row = batch.row(batch_rows);
+	row.reshape(1, 1).convertTo(batch_row, CV_64F);
+	if (++batch_rows == batch.rows) Flush();
+}
+
+/**
+ * Batch rows are centered on the batch mean, so the scatter matrix does not suffer from cancellation of large sums.
+ */
+void CovarianceAccumulator::Flush()
+{
+	if (batch_rows == 0) return;
+	const Mat rows = batch.rowRange(0, batch_rows);
+	Mat batch_mean;
+	reduce(rows, batch_mean, 0, REDUCE_AVG, CV_64F);
+	Mat batch_scatter;
+	mulTransposed(rows, batch_scatter, true, batch_mean, 1, CV_64F);
+	MergeMoments(batch_mean, batch_scatter, batch_rows);
+	batch_rows = 0;
+}
+
+void CovarianceAccumulator::MergeMoments(const Mat& other_mean, const Mat& other_scatter, int64_t other_count)
+{
+	if (other_count == 0) return;
+	const double n_a = static_cast<double>(count);
+	const double n_b = static_cast<double>(other_count);
+	const double n = n_a + n_b;
+	const Mat delta = other_mean - mean;
+
+	scatter += other_scatter;
+	if (count > 0) gemm(delta, delta, n_a * n_b / n, scatter, 1, scatter, GEMM_1_T);
+	mean += delta * (n_b / n);
+	count += other_count;
+}
+
+void CovarianceAccumulator::Merge(CovarianceAccumulator& other)
+{
+	if (other.dim != dim) throw invalid_argument("CovarianceAccumulator: Inconsistent data size!");
+	other.Flush();
+	MergeMoments(other.mean, other.scatter, other.count);
+}
+
+/**
+ * Covariance is scaled by 1/N (as in cv::PCA). Number of components is limited by the number of rows.
+ * Throws a runtime error when no rows were added.
+ */
+PCA CovarianceAccumulator::Finish(int max_components, double retained_variance)
+{
+	Flush();
+	if (count == 0) throw runtime_error("CovarianceAccumulator: no data to calculate pca");
+
+	Mat eigenvalues, eigenvectors;
+	eigen(scatter / static_cast<double>(count), eigenvalues, eigenvectors);
+	const int num_components = NumComponents(eigenvalues, static_cast<int>(min<int64_t>(dim, count)), max_components, retained_variance);
+
+	PCA pca;
+	mean.convertTo(pca.mean, CV_32F);
+	eigenvectors.rowRange(0, num_components).convertTo(pca.eigenvectors, CV_32F);
+	eigenvalues.rowRange(0, num_components).convertTo(pca.eigenvalues, CV_32F);
+	return pca;
+}
+
+double CovarianceAccumulator::TotalVariance() const
+{
+	return (count > 0) ? trace(scatter)[0] / count : 0;
+}
+
+namespace pca_engine
+{
+	/**
+	 * Cost of a pass of the randomized solver is about 2 * (power iterations + 2) * (components + oversampling)
+	 * multiply-adds per value, of the exact solvers min(rows, dim) - the randomized solver is chosen when it is cheaper
+	 * (only for a fixed number of components) or when neither the covariance nor the gram matrix fits in the memory budget.
+	 * Of the exact solvers the one with the smaller matrix is chosen (covariance matrix is allocated by every thread),
+	 * if neither fits then the out of core solver (one covariance matrix) is tried before the randomized one.
+	 */
+	PcaSolver SelectSolver(int num_rows, int dim, const PcaOptions& options, string& reason)
+	{
+		if (options.solver != pca_auto) {
+			reason = "chosen in options";
+			return options.solver;
+		}
+
+		const double megabyte = 1024.0 * 1024.0;
+		const double covariance_bytes = static_cast<double>(dim) * dim * sizeof(double) * (getNumThreads() + 1);
+		const double gram_bytes = static_cast<double>(num_rows) * num_rows * sizeof(double);
+		const int width = options.components + options.oversampling;
+		const bool fixed_components = options.components > 0 && options.retained_variance <= 0;
+		ostringstream description;
+
+		if (fixed_components && 2 * (options.power_iterations + 2) * width < min(num_rows, dim)) {
+			description << options.components << " components of " << min(num_rows, dim) << " possible - "
+				<< "randomized passes (width " << width << ") are cheaper than a full decomposition";
+			reason = description.str();
+			return pca_randomized;
+		}
+
+		const bool covariance_fits = covariance_bytes <= options.memory_budget;
+		const bool gram_fits = gram_bytes <= options.memory_budget;
+		if (covariance_fits && (num_rows >= dim || !gram_fits)) {
+			description << "images (" << num_rows << ") >= dimension (" << dim << "), covariance matrices take "
+				<< covariance_bytes / megabyte << " MB";
+			reason = description.str();
+			return pca_covariance;
+		}
+		if (gram_fits) {
+			description << "dimension (" << dim << ") > images (" << num_rows << "), gram matrix takes " << gram_bytes / megabyte << " MB";
+			reason = description.str();
+			return pca_gram;
+		}
+
+		description << "covariance (" << covariance_bytes / megabyte << " MB) and gram (" << gram_bytes / megabyte
+			<< " MB) matrices exceed the memory budget (" << options.memory_budget / megabyte << " MB)";
+		const double out_of_core_bytes = 2.0 * dim * dim * sizeof(double);
+		if (!fixed_components && out_of_core_bytes <= options.memory_budget) {
+			description << ", single covariance matrix takes " << out_of_core_bytes / megabyte << " MB";
+			reason = description.str();
+			return pca_out_of_core;
+		}
+		reason = description.str();
+		return pca_randomized;
+	}
+
+	/**
+	 * Size of rows is read from the first row. Throws a runtime error when there are no rows.
+	 */
+	PCA Fit(int num_rows, const RowSource& rows, const PcaOptions& options, PcaReport* report)
+	{
+		if (num_rows <= 0) throw runtime_error("Fit: no data to calculate pca");
+		const int dim = static_cast<int>(rows(0).total());
+
+		string reason;
+		const PcaSolver solver = SelectSolver(num_rows, dim, options, reason);
+		if (report) {
+			report->solver = solver;
+			report->reason = reason;
+		}
+
+		switch (solver) {
+		case pca_covariance:
+			return FitCovariance(num_rows, rows, options.components, options.retained_variance, report);
+		case pca_gram:
+			return FitGram(num_rows, rows, options.components, options.retained_variance, options.memory_budget, report);
+		case pca_randomized:
+			return FitRandomized(num_rows, rows, options, report);
+		case pca_out_of_core:
+			return FitOutOfCore(num_rows, rows, options, report);
+		default:
+			throw invalid_argument("Fit: unknown pca solver");
+		}
+	}
+
+	/**
+	 * Scratch pass: every thread processes tiles of rows straight into the mapped file and sums them (mean),
+	 * the tile memory budget is divided between the threads mapping their tiles at the same time.
+	 * Covariance pass: tiles are read in order, while a tile is centered and multiplied the next one is prefetched;
+	 * scatter += tile^T * tile is computed by threads in blocks of scatter rows (exact, two-pass centering).
+	 */
+	PCA FitOutOfCore(int num_rows, const RowSource& rows, const PcaOptions& options, PcaReport* report)
+	{
+		if (num_rows <= 0) throw runtime_error("FitOutOfCore: no data to calculate pca");
+		PhaseTimer timer(report);
+		const int dim = static_cast<int>(rows(0).total());
+		const int64_t matrix_bytes = 2 * static_cast<int64_t>(dim) * dim * sizeof(double);
+		const int64_t tile_budget = max<int64_t>(0, options.memory_budget - matrix_bytes);
+		// covariance pass tile: current and prefetched mapped float rows and centered double rows
+		const int64_t tile_row_bytes = static_cast<int64_t>(dim) * (2 * sizeof(float) + sizeof(double));
+		const int tile_rows = static_cast<int>(min<int64_t>(num_rows, max<int64_t>(pass_batch_size, tile_budget / tile_row_bytes)));
+		const int num_tiles = (num_rows + tile_rows - 1) / tile_rows;
+		const auto tile_range = [&](int tile) { return Range(tile * tile_rows, min(num_rows, (tile + 1) * tile_rows)); };
+		// scratch pass tile: every concurrent worker maps its own float rows, the budget is divided between them
+		const int workers = max(1, getNumThreads());
+		const int write_tile_rows = static_cast<int>(min<int64_t>(tile_rows, max<int64_t>(pass_batch_size,
+			tile_budget / workers / (static_cast<int64_t>(dim) * sizeof(float)))));
+
+		ScratchMatrix scratch(num_rows, dim, options.scratch_directory);
+		Mat total_sum = Mat::zeros(1, dim, CV_64F);
+		mutex total_mutex;
+		preprocessing::ParallelFor(Range(0, num_rows), [&](const Range& range) {
+			Mat partial_sum = Mat::zeros(1, dim, CV_64F);
+			for (int begin = range.start; begin < range.end; begin += write_tile_rows) {
+				const int count = min(write_tile_rows, range.end - begin);
+				const auto tile = scratch.MapTile(begin, count);
+				for (int i = 0; i < count; i++) {
+					Mat tile_row = tile->GetRows().row(i);
+					rows(begin + i).reshape(1, 1).convertTo(tile_row, CV_32F);
+					add(partial_sum, tile_row, partial_sum, noArray(), CV_64F);
+				}
+			}
+			lock_guard<mutex> lock(total_mutex);
+			total_sum += partial_sum;
+		}, (num_rows + write_tile_rows - 1) / write_tile_rows);
+		const Mat mean = total_sum / num_rows;
+		timer.Finish("scratch pass");
+
+		Mat scatter = Mat::zeros(dim, dim, CV_64F);
+		Mat centered(tile_rows, dim, CV_64F);
+		const int block_rows = max(1, dim / max(1, getNumThreads()));
+		auto next = scratch.MapTile(0, tile_range(0).size());
+		next->Prefetch();
+		for (int tile = 0; tile < num_tiles; tile++) {
+			const auto current = move(next);
+			if (tile + 1 < num_tiles) {
+				next = scratch.MapTile(tile_range(tile + 1).start, tile_range(tile + 1).size());
+				next->Prefetch();
+			}
+
+			const int count = current->GetRows().rows;
+			Mat tile_centered = centered.rowRange(0, count);
+			for (int i = 0; i < count; i++) {
+				Mat centered_row = tile_centered.row(i);
+				current->GetRows().row(i).convertTo(centered_row, CV_64F);
+				centered_row -= mean;
+			}
+			preprocessing::ParallelFor(Range(0, dim), [&](const Range& range) {
+				Mat block = scatter.rowRange(range);
+				gemm(tile_centered.colRange(range), tile_centered, 1, block, 1, block, GEMM_1_T);
+			}, (dim + block_rows - 1) / block_rows);
+		}
+		timer.Finish("covariance pass (" + to_string(num_tiles) + " tiles)");
+
+		Mat eigenvalues, eigenvectors;
+		eigen(scatter / static_cast<double>(num_rows), eigenvalues, eigenvectors);
+		const double total_variance = trace(scatter)[0] / num_rows;
+		const int num_components = NumComponents(eigenvalues, min(dim, num_rows), options.components, options.retained_variance);
+		timer.Finish("eigen decomposition");
+
+		PCA pca;
+		mean.convertTo(pca.mean, CV_32F);
+		eigenvectors.rowRange(0, num_components).convertTo(pca.eigenvectors, CV_32F);
+		eigenvalues.rowRange(0, num_components).convertTo(pca.eigenvalues, CV_32F);
+		if (report) {
+			report->total_variance = total_variance;
+			report->captured_variance = (total_variance > 0) ? sum(pca.eigenvalues)[0] / total_variance : 1.0;
+		}
+		return pca;
+	}
+
+	/**
+	 * Planes are fitted one after another on column ranges of the rows (every plane pass processes the rows again,
+	 * memory is that of the largest plane instead of the whole row).
+	 */
+	PCA FitPerPlane(int num_rows, const RowSource& rows, const vector<int>& plane_sizes, const PcaOptions& options, PcaReport* report)
+	{
+		const int dim = accumulate(plane_sizes.begin(), plane_sizes.end(), 0);
+		vector<PCA> planes;
+		double captured = 0, total_variance = 0;
+		string reason;
+		int offset = 0, num_components = 0;
+
+		for (size_t p = 0; p < plane_sizes.size(); p++) {
+			const int plane_offset = offset;
+			const int plane_size = plane_sizes[p];
+			PcaOptions plane_options = options;
+			if (options.components > 0) {
+				plane_options.components = max(1, static_cast<int>(static_cast<int64_t>(options.components) * plane_size / dim));
+			}
+
+			PcaReport plane_report;
+			planes.push_back(Fit(num_rows, [&](int i) { return rows(i).reshape(1, 1).colRange(plane_offset, plane_offset + plane_size); },
+				plane_options, &plane_report));
+			captured += plane_report.captured_variance * plane_report.total_variance;
+			total_variance += plane_report.total_variance;
+			reason += (p ? "; plane " : "plane ") + to_string(p) + ": " + SolverName(plane_report.solver) + " - " + plane_report.reason;
+			if (report) {
+				for (auto& phase : plane_report.phase_seconds) {
+					report->phase_seconds.emplace_back("plane " + to_string(p) + " " + phase.first, phase.second);
+				}
+			}
+			offset += plane_size;
+			num_components += planes.back().eigenvectors.rows;
+		}
+
+		Mat eigenvectors = Mat::zeros(num_components, dim, CV_32F);
+		Mat eigenvalues(num_components, 1, CV_32F);
+		PCA pca;
+		pca.mean.create(1, dim, CV_32F);
+		offset = 0;
+		int component = 0;
+		for (size_t p = 0; p < planes.size(); p++) {
+			const Range columns(offset, offset + plane_sizes[p]);
+			const Range components(component, component + planes[p].eigenvectors.rows);
+			planes[p].mean.reshape(1, 1).convertTo(pca.mean.colRange(columns), CV_32F);
+			planes[p].eigenvectors.convertTo(eigenvectors(components, columns), CV_32F);
+			planes[p].eigenvalues.reshape(1, components.size()).convertTo(eigenvalues.rowRange(components), CV_32F);
+			offset = columns.end;
+			component = components.end;
+		}
+
+		// components of all the planes sorted by eigenvalue (descending, planes keep their order on ties)
+		vector<int> order(num_components);
+		iota(order.begin(), order.end(), 0);
+		stable_sort(order.begin(), order.end(), [&eigenvalues](int a, int b) { return eigenvalues.at<float>(a) > eigenvalues.at<float>(b); });
+		pca.eigenvectors.create(num_components, dim, CV_32F);
+		pca.eigenvalues.create(num_components, 1, CV_32F);
+		for (int i = 0; i < num_components; i++) {
+			eigenvectors.row(order[i]).copyTo(pca.eigenvectors.row(i));
+			pca.eigenvalues.at<float>(i) = eigenvalues.at<float>(order[i]);
+		}
+
+		// planes may use different solvers, the solver of every plane is reported in the reason
+		if (report) {
+			report->solver = pca_auto;
+			report->reason = reason;
+			report->total_variance = total_variance;
+			report->captured_variance = (total_variance > 0) ? captured / total_variance : 1.0;
+		}
+		return pca;
+	}
+
+	/**
+	 * Every thread accumulates covariance of its part of the rows, partial results are merged at the end
+	 * (memory: dim x dim doubles per thread).
+	 */
+	PCA FitCovariance(int num_rows, const RowSource& rows, int max_components, double retained_variance, PcaReport* report)
+	{
+		PhaseTimer timer(report);
+		unique_ptr<CovarianceAccumulator> total;
+		mutex total_mutex;
+
+		preprocessing::ParallelFor(Range(0, num_rows), [&](const Range& range) {
+			unique_ptr<CovarianceAccumulator> partial;
+			for (int i = range.start; i < range.end; i++) {
+				const Mat row = rows(i);
+				if (!partial) partial = make_unique<CovarianceAccumulator>(static_cast<int>(row.total()));
+				partial->Add(row);
+			}
+			if (!partial) return;
+
+			lock_guard<mutex> lock(total_mutex);
+			if (total) total->Merge(*partial);
+			else total = move(partial);
+		}, getNumThreads());
+
+		if (!total) throw runtime_error("FitCovariance: no data to calculate pca");
+		timer.Finish("covariance");
+
+		PCA pca = total->Finish(max_components, retained_variance);
+		timer.Finish("eigen decomposition");
+		if (report) {
+			report->total_variance = total->TotalVariance();
+			report->captured_variance = (total->TotalVariance() > 0) ? sum(pca.eigenvalues)[0] / total->TotalVariance() : 1.0;
+		}
+		return pca;
+	}
+
+	/**
+	 * Passes over the rows (X - centered data matrix, never built):
+	 * 1. mean and total variance,
+	 * 2. gram matrix G = X * X^T - for every tile of rows (kept in memory) products with the tile and all the following rows,
+	 * 3. eigen decomposition G / N = U * S * U^T,
+	 * 4. components = S^(-1/2) * U^T * X / sqrt(N), eigenvalues = S (components with zero eigenvalues are dropped).
+	 */
+	PCA FitGram(int num_rows, const RowSource& rows, int max_components, double retained_variance, int64_t memory_budget, PcaReport* report)
+	{
+		if (num_rows <= 0) throw runtime_error("FitGram: no data to calculate pca");
+		PhaseTimer timer(report);
+
+		Mat mean;
+		double total_variance = 0;
+		MeanPass(num_rows, rows, mean, total_variance);
+		const int dim = mean.cols;
+		timer.Finish("mean");
+
+		const int64_t gram_bytes = static_cast<int64_t>(num_rows) * num_rows * static_cast<int64_t>(sizeof(double));
+		const int64_t row_bytes = static_cast<int64_t>(dim) * static_cast<int64_t>(sizeof(float));
+		const int tile_rows = static_cast<int>(max<int64_t>(1, min<int64_t>(num_rows, (memory_budget - gram_bytes) / row_bytes)));
+		Mat gram = Mat::zeros(num_rows, num_rows, CV_64F);
+		Mat tile(tile_rows, dim, CV_32F);
+
+		for (int tile_begin = 0; tile_begin < num_rows; tile_begin += tile_rows) {
+			const int tile_end = min(num_rows, tile_begin + tile_rows);
+			preprocessing::ParallelFor(Range(tile_begin, tile_end), [&](const Range& range) {
+				Mat tile_part = tile.rowRange(range.start - tile_begin, range.end - tile_begin);
+				LoadCentered(rows, mean, range.start, range.size(), tile_part);
+			}, getNumThreads());
+			const Mat tile_data = tile.rowRange(0, tile_end - tile_begin);
+
+			// upper triangle: products of the tile with its own rows (copied from the tile) and all the following rows
+			preprocessing::ParallelFor(Range(tile_begin, num_rows), [&](const Range& range) {
+				Mat batch(pass_batch_size, dim, CV_32F);
+				Mat block;
+				for (int begin = range.start; begin < range.end; begin += pass_batch_size) {
+					const int batch_rows = min(pass_batch_size, range.end - begin);
+					for (int i = 0; i < batch_rows; i++) {
+						Mat batch_row = batch.row(i);
+						if (begin + i < tile_end) tile_data.row(begin + i - tile_begin).copyTo(batch_row);
+						else LoadCentered(rows, mean, begin + i, 1, batch_row);
+					}
+					gemm(tile_data, batch.rowRange(0, batch_rows), 1, noArray(), 0, block, GEMM_2_T);
+					Mat gram_block = gram(Range(tile_begin, tile_end), Range(begin, begin + batch_rows));
+					block.convertTo(gram_block, CV_64F);
+				}
+			}, getNumThreads());
+		}
+		completeSymm(gram);
+		timer.Finish("gram matrix");
+
+		Mat eigenvalues, eigenvectors;
+		eigen(gram / static_cast<double>(num_rows), eigenvalues, eigenvectors);
+		timer.Finish("eigen decomposition");
+
+		const double max_eigenvalue = eigenvalues.at<double>(0);
+		int nonzero = 0;
+		while (nonzero < eigenvalues.rows && eigenvalues.at<double>(nonzero) > max_eigenvalue * 1e-10) nonzero++;
+		const int num_components = min(NumComponents(eigenvalues, num_rows, max_components, retained_variance), max(nonzero, 1));
+
+		Mat coefficients(num_components, num_rows, CV_32F);
+		for (int k = 0; k < num_components; k++) {
+			const double scale = 1.0 / sqrt(max(eigenvalues.at<double>(k), 1e-30) * num_rows);
+			Mat coefficients_row = coefficients.row(k);
+			eigenvectors.row(k).convertTo(coefficients_row, CV_32F, scale);
+		}
+
+		Mat components = Mat::zeros(num_components, dim, CV_32F);
+		mutex total_mutex;
+		preprocessing::ParallelFor(Range(0, num_rows), [&](const Range& range) {
+			Mat batch(pass_batch_size, dim, CV_32F);
+			Mat partial = Mat::zeros(num_components, dim, CV_32F);
+			for (int begin = range.start; begin < range.end; begin += pass_batch_size) {
+				const int batch_rows = min(pass_batch_size, range.end - begin);
+				LoadCentered(rows, mean, begin, batch_rows, batch);
+				gemm(coefficients.colRange(begin, begin + batch_rows), batch.rowRange(0, batch_rows), 1, partial, 1, partial);
+			}
+			lock_guard<mutex> lock(total_mutex);
+			components += partial;
+		}, getNumThreads());
+		timer.Finish("components");
+
+		PCA pca;
+		pca.mean = mean;
+		pca.eigenvectors = components;
+		eigenvalues.rowRange(0, num_components).convertTo(pca.eigenvalues, CV_32F);
+		if (report) {
+			report->total_variance = total_variance;
+			report->captured_variance = (total_variance > 0) ? sum(pca.eigenvalues)[0] / total_variance : 1.0;
+		}
+		return pca;
+	}
+
+	/**
+	 * Passes over the rows (X - centered data matrix, never built):
+	 * 1. mean and total variance,
+	 * 2. range finder: Q = orth(X^T * X * omega), omega - random gaussian dim x (components + oversampling),
+	 * 3. power iterations: Q = orth(X^T * X * Q),
+	 * 4. small eigen problem: (X * Q)^T * (X * Q) = V * S * V^T, components = V^T * Q^T, eigenvalues = S / number of rows.
+	 * Captured variance is the sum of the eigenvalues divided by the total variance, retained variance is also
+	 * relative to the total variance (all the components are kept if it is not reached).
+	 * When the number of components is not limited, 100 components are calculated.
+	 */
+	PCA FitRandomized(int num_rows, const RowSource& rows, const PcaOptions& options, PcaReport* report)
+	{
+		if (num_rows <= 0) throw runtime_error("FitRandomized: no data to calculate pca");
+		if (options.oversampling < 0 || options.power_iterations < 0) {
+			throw invalid_argument("FitRandomized: oversampling and power iterations must be non-negative");
+		}
+		PhaseTimer timer(report);
+
+		Mat mean;
+		double total_variance = 0;
+		MeanPass(num_rows, rows, mean, total_variance);
+		const int dim = mean.cols;
+		const int num_components = min(options.components > 0 ? options.components : 100, min(dim, num_rows));
+		const int width = min(num_components + options.oversampling, dim);
+		timer.Finish("mean");
+
+		Mat basis(dim, width, CV_32F);
+		RNG rng(options.seed);
+		rng.fill(basis, RNG::NORMAL, 0, 1);
+
+		Mat product;
+		for (int i = 0; i <= options.power_iterations; i++) {
+			ProjectedPass(num_rows, rows, mean, basis, &product, nullptr);
+			basis = Orthonormalize(product);
+			timer.Finish(i == 0 ? "range finder" : "power iteration");
+		}
+
+		Mat gram;
+		ProjectedPass(num_rows, rows, mean, basis, nullptr, &gram);
+		Mat eigenvalues, eigenvectors;
+		eigen(gram / static_cast<double>(num_rows), eigenvalues, eigenvectors);
+		const int kept = NumComponents(eigenvalues, num_components, 0, options.retained_variance, total_variance);
+
+		PCA pca;
+		pca.mean = mean;
+		Mat small_vectors;
+		eigenvectors.rowRange(0, kept).convertTo(small_vectors, CV_32F);
+		gemm(small_vectors, basis, 1, noArray(), 0, pca.eigenvectors, GEMM_2_T);
+		eigenvalues.rowRange(0, kept).convertTo(pca.eigenvalues, CV_32F);
+		timer.Finish("projection and eigen decomposition");
+
+		if (report) {
+			report->total_variance = total_variance;
+			report->captured_variance = (total_variance > 0) ? sum(pca.eigenvalues)[0] / total_variance : 1.0;
+		}
+		return pca;
+	}
+
+	/**
+	 * Negative eigenvalues (rounding errors) are treated as zeros. At least one component is returned.
+	 */
+	int ComponentsForVariance(const Mat& eigenvalues, double retained_variance, double total_variance)
+	{
+		Mat values;
+		eigenvalues.reshape(1, 1).convertTo(values, CV_64F);
+		values.setTo(0, values < 0);
+		const double total = (total_variance > 0) ? total_variance : sum(values)[0];
+		if (total <= 0) return 1;
+
+		double retained = 0;
+		for (int i = 0; i < values.cols; i++) {
+			retained += values.at<double>(i);
+			if (retained / total >= retained_variance) return i + 1;
+		}
+		return values.cols;
+	}
+
+	/**
+	 * Stratified sample takes from every label a number of rows proportional to its size (largest remainder rounding).
+	 */
+	vector<int> SampleRows(const vector<int>& labels, int num_samples, bool stratified, uint64_t seed)
+	{
+		vector<int> order(labels.size());
+		iota(order.begin(), order.end(), 0);
+		mt19937_64 generator(seed);
+		shuffle(order.begin(), order.end(), generator);
+		if (!stratified || num_samples <= 0 || num_samples >= static_cast<int>(order.size())) return order;
+
+		map<int, vector<int>> groups;
+		for (int index : order) groups[labels[index]].push_back(index);
+
+		vector<int> quotas;
+		vector<pair<double, size_t>> remainders;
+		int assigned = 0;
+		for (auto& group : groups) {
+			const double exact = static_cast<double>(num_samples) * group.second.size() / order.size();
+			quotas.push_back(static_cast<int>(exact));
+			remainders.emplace_back(exact - quotas.back(), quotas.size() - 1);
+			assigned += quotas.back();
+		}
+		sort(remainders.begin(), remainders.end(), [](const pair<double, size_t>& a, const pair<double, size_t>& b) { return a.first > b.first; });
+		for (int i = 0; i < num_samples - assigned; i++) quotas[remainders[i].second]++;
+
+		vector<int> sample, rest;
+		size_t g = 0;
+		for (auto& group : groups) {
+			sample.insert(sample.end(), group.second.begin(), group.second.begin() + quotas[g]);
+			rest.insert(rest.end(), group.second.begin() + quotas[g], group.second.end());
+			g++;
+		}
+		shuffle(sample.begin(), sample.end(), generator);
+		shuffle(rest.begin(), rest.end(), generator);
+		sample.insert(sample.end(), rest.begin(), rest.end());
+		return sample;
+	}
+
+	/**
+	 * Ratio of the squared norm of the projections to the squared norm of the centered rows, rows projected in parallel batches.
+	 */
+	double CapturedVariance(const PCA& pca, int num_rows, const RowSource& rows)
+	{
+		double total_captured = 0, total_variance = 0;
+		mutex total_mutex;
+
+		preprocessing::ParallelFor(Range(0, num_rows), [&](const Range& range) {
+			Mat batch(pass_batch_size, pca.mean.cols, CV_32F);
+			Mat projections;
+			double captured = 0, variance = 0;
+			for (int begin = range.start; begin < range.end; begin += pass_batch_size) {
+				const int batch_rows = min(pass_batch_size, range.end - begin);
+				LoadCentered(rows, pca.mean, begin, batch_rows, batch);
+				const Mat centered = batch.rowRange(0, batch_rows);
+				gemm(centered, pca.eigenvectors, 1, noArray(), 0, projections, GEMM_2_T);
+				captured += projections.dot(projections);
+				variance += centered.dot(centered);
+			}
+
+			lock_guard<mutex> lock(total_mutex);
+			total_captured += captured;
+			total_variance += variance;
+		}, getNumThreads());
+
+		return (total_variance > 0) ? total_captured / total_variance : 1.0;
+	}
+
+	/**
+	 * Rows are centered before the product (subtracting the projected mean afterwards loses precision in float
+	 * when the mean is large compared to the deviations).
+	 */
+	void Project(const PCA& pca, const Mat& rows, Mat& projections)
+	{
+		if (rows.type() != CV_32F || pca.mean.type() != CV_32F || rows.cols != pca.mean.cols) {
+			throw invalid_argument("Project: rows must be CV_32F with the size of the pca mean");
+		}
+		Mat centered(rows.rows, rows.cols, CV_32F);
+		for (int i = 0; i < rows.rows; i++) subtract(rows.row(i), pca.mean, centered.row(i));
+		gemm(centered, pca.eigenvectors, 1, noArray(), 0, projections, GEMM_2_T);
+	}
+
+	/**
+	 * Pca whitening scales every eigenvector by 1 / sqrt(eigenvalue + epsilon), zca whitening multiplies the scaled
+	 * eigenvectors by the transposed eigenvectors (rotation back to the image space).
+	 */
+	PCA Whiten(const PCA& pca, PcaWhitening whitening, double epsilon)
+	{
+		if (pca.eigenvectors.empty() || pca.eigenvalues.total() != static_cast<size_t>(pca.eigenvectors.rows)) {
+			throw invalid_argument("Whiten: pca is not calculated or its eigenvalues do not match the eigenvectors");
+		}
+		if (epsilon < 0) throw invalid_argument("Whiten: epsilon must not be negative");
+
+		Mat eigenvectors, scales;
+		pca.eigenvectors.convertTo(eigenvectors, CV_32F);
+		pca.eigenvalues.reshape(1, pca.eigenvectors.rows).convertTo(scales, CV_32F);
+		scales.setTo(0, scales < 0);
+		scales += epsilon;
+		sqrt(scales, scales);
+		divide(1, scales, scales);
+
+		PCA whitened;
+		whitened.mean = pca.mean;
+		whitened.eigenvalues = pca.eigenvalues;
+		switch (whitening) {
+		case no_whitening:
+			whitened.eigenvectors = eigenvectors;
+			break;
+		case pca_whitening:
+			whitened.eigenvectors = eigenvectors.mul(repeat(scales, 1, eigenvectors.cols));
+			break;
+		case zca_whitening:
+			gemm(eigenvectors, eigenvectors.mul(repeat(scales, 1, eigenvectors.cols)), 1, noArray(), 0, whitened.eigenvectors, GEMM_1_T);
+			break;
+		default:
+			throw invalid_argument("Whiten: unknown whitening");
+		}
+		return whitened;
+	}
+
+	/**
+	 * Format: |header (64 bytes)|mean|eigenvalues|eigenvectors|, values are float32, every array and every eigenvector row
+	 * starts at a multiple of 64 bytes (rows are padded with zeros).
+	 * Whitening is stored in the reserved part of the header (zeros in files without whitening).
+	 */
+	void SaveModel(const string& path, const PCA& pca, PcaWhitening whitening, double epsilon)
+	{
+		if (pca.mean.empty() || pca.eigenvectors.empty()) throw invalid_argument("SaveModel: pca is not calculated");
+		ofstream file(path, ios::out | ofstream::binary | ios::trunc);
+		if (!file) throw invalid_argument("SaveModel: file could not be opened: " + path);
+
+		Mat mean, eigenvalues, eigenvectors;
+		pca.mean.reshape(1, 1).convertTo(mean, CV_32F);
+		pca.eigenvalues.reshape(1, 1).convertTo(eigenvalues, CV_32F);
+		pca.eigenvectors.convertTo(eigenvectors, CV_32F);
+
+		ModelHeader header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, model_magic, sizeof(model_magic));
+		header.version = model_version;
+		header.dim = mean.cols;
+		header.components = eigenvectors.rows;
+		if (whitening != no_whitening) {
+			header.whitening = whitening;
+			header.whitening_epsilon = static_cast<float>(epsilon);
+		}
+		if (eigenvalues.cols != eigenvectors.rows) header.num_eigenvalues = eigenvalues.cols;
+		header.mean_offset = Align(sizeof(ModelHeader));
+		header.eigenvalues_offset = Align(header.mean_offset + mean.cols * sizeof(float));
+		header.eigenvectors_offset = Align(header.eigenvalues_offset + eigenvalues.cols * sizeof(float));
+		header.eigenvectors_step = Align(header.dim * sizeof(float));
+
+		const auto write_at = [&file](int64_t offset, const void* data, size_t size) {
+			const int64_t padding = offset - static_cast<int64_t>(file.tellp());
+			for (int64_t i = 0; i < padding; i++) file.put(0);
+			file.write(static_cast<const char*>(data), size);
+		};
+		write_at(0, &header, sizeof(header));
+		write_at(header.mean_offset, mean.ptr(), mean.cols * sizeof(float));
+		write_at(header.eigenvalues_offset, eigenvalues.ptr(), eigenvalues.cols * sizeof(float));
+		for (int i = 0; i < eigenvectors.rows; i++) {
+			write_at(header.eigenvectors_offset + i * header.eigenvectors_step, eigenvectors.ptr(i), header.dim * sizeof(float));
+		}
+		write_at(header.eigenvectors_offset + header.components * header.eigenvectors_step, nullptr, 0);
+		if (!file) throw runtime_error("SaveModel: writing the file failed: " + path);
+	}
+
+	/**
+	 * Throws an invalid argument error for files with wrong magic, version or size.
+	 */
+	PCA LoadModel(const MappedFile& file, PcaWhitening* whitening)
+	{
+		ModelHeader header;
+		if (file.GetSize() < sizeof(header)) throw invalid_argument("LoadModel: file too small: " + file.GetPath());
+		memcpy(&header, file.GetData(), sizeof(header));
+		if (memcmp(header.magic, model_magic, sizeof(model_magic)) != 0 || header.version != model_version) {
+			throw invalid_argument("LoadModel: not a pca model file (or unsupported version): " + file.GetPath());
+		}
+		const int32_t num_eigenvalues = header.num_eigenvalues ? header.num_eigenvalues : header.components;
+		const int64_t file_size = static_cast<int64_t>(file.GetSize());
+		const int64_t row_size = header.dim * static_cast<int64_t>(sizeof(float));
+		auto in_file = [file_size](int64_t offset, int64_t length) {
+			return offset >= 0 && length >= 0 && length <= file_size && offset <= file_size - length;
+		};
+		if (header.dim <= 0 || header.components <= 0 || num_eigenvalues <= 0 ||
+			header.eigenvectors_step < row_size || header.eigenvectors_step > file_size ||
+			!in_file(header.mean_offset, row_size) ||
+			!in_file(header.eigenvalues_offset, num_eigenvalues * static_cast<int64_t>(sizeof(float))) ||
+			!in_file(header.eigenvectors_offset, (header.components - 1) * header.eigenvectors_step + row_size)) {
+			throw invalid_argument("LoadModel: corrupted pca model file: " + file.GetPath());
+		}
+		if (header.whitening != 0 && header.whitening != no_whitening && header.whitening != pca_whitening && header.whitening != zca_whitening) {
+			throw invalid_argument("LoadModel: unknown whitening of the pca model: " + file.GetPath());
+		}
+
+		char* data = const_cast<char*>(file.GetData());
+		PCA pca;
+		pca.mean = Mat(1, header.dim, CV_32F, data + header.mean_offset);
+		pca.eigenvalues = Mat(num_eigenvalues, 1, CV_32F, data + header.eigenvalues_offset);
+		pca.eigenvectors = Mat(header.components, header.dim, CV_32F, data + header.eigenvectors_offset, static_cast<size_t>(header.eigenvectors_step));
+		if (whitening) *whitening = header.whitening ? static_cast<PcaWhitening>(header.whitening) : no_whitening;
+		return pca;
+	}
+
+	string SolverName(PcaSolver solver)
+	{
+		switch (solver) {
+		case pca_auto: return "auto";
+		case pca_covariance: return "covariance";
+		case pca_gram: return "gram";
+		case pca_randomized: return "randomized";
+		case pca_out_of_core: return "out of core";
+		default: return "unknown";
+		}
+	}
+}
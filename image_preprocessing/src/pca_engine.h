@@ -0,0 +1,307 @@
+/**
+* @file pca_engine.h
+* @brief PCA engine - fitting principal components from a stream of rows without the data matrix.
+*/
+
+#ifndef PCA_ENGINE_H
+#define PCA_ENGINE_H
+
+#include <opencv2/core/core.hpp>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+#include <utility>
+
+class MappedFile;
+
+/**
+ *  Enum for available pca solvers.
+ *  Default char values for easier commandline arguments parsing.
+ */
+enum PcaSolver {
+	pca_auto = 'a', /**< cheapest solver chosen from the data size, number of components and memory budget */
+	pca_covariance = 'c', /**< covariance matrix accumulated in one pass, full eigen decomposition (dim x dim) */
+	pca_gram = 'g', /**< gram matrix of centered rows (rows x rows) computed in tiles, full eigen decomposition */
+	pca_randomized = 'r', /**< randomized truncated svd (Halko et al.), several passes, memory dim x (components + oversampling) */
+	pca_out_of_core = 'o' /**< rows processed once into a scratch file, one covariance matrix accumulated from tiles within the memory budget */
+};
+
+/**
+ *  Enum for rows of color images used by the pca.
+ *  Default char values for easier commandline arguments parsing.
+ */
+enum PcaInput {
+	pca_luma = 'l', /**< luminance only */
+	pca_joint = 'j', /**< luminance and decimated chrominances (planar formatted vector), one basis */
+	pca_per_plane = 'p' /**< separate basis for every plane, components of all the planes sorted by eigenvalue (each non-zero only in its plane) */
+};
+
+/**
+ *  Enum for whitening of the pca projections.
+ *  Default char values for easier commandline arguments parsing.
+ */
+enum PcaWhitening {
+	no_whitening = 'n', /**< projections onto the components */
+	pca_whitening = 'p', /**< projections scaled by 1 / sqrt(eigenvalue + epsilon) - unit variance of every component */
+	zca_whitening = 'z' /**< pca whitened projections rotated back to the image space (dim values) */
+};
+
+/**
+ * @brief Struct representing pca options.
+ */
+struct PcaOptions {
+
+	/**
+	 * @brief Default PcaOptions constructor.
+	 */
+	PcaOptions();
+
+	PcaSolver solver; /**< Solver used to calculate principal components */
+	int components; /**< Maximum number of components (0 - not limited) */
+	double retained_variance; /**< Fraction of variance retained by the components (0 - not used) */
+	int oversampling; /**< Number of additional random vectors of the randomized solver */
+	int power_iterations; /**< Number of power iterations of the randomized solver (improve accuracy for slowly decaying spectra) */
+	uint64_t seed; /**< Seed of the random test matrix of the randomized solver */
+	int64_t memory_budget; /**< Memory available for the covariance/gram matrix (bytes), used by the automatic solver selection */
+	int fit_samples; /**< Number of rows the pca is fitted on (0 - all rows) */
+	bool stratified; /**< Flag for sampling the rows proportionally to the number of rows with each label */
+	PcaInput input; /**< Planes of color images used by the pca (grayscale images always use the luminance) */
+	std::string scratch_directory; /**< Directory of the scratch file of the out of core solver (empty - system temporary directory) */
+	PcaWhitening whitening; /**< Whitening of the projections */
+	double whitening_epsilon; /**< Value added to the eigenvalues before whitening (limits the scaling of low variance components) */
+};
+
+/**
+ * @brief Struct representing a summary of the pca fit.
+ */
+struct PcaReport {
+
+	/**
+	 * @brief Default PcaReport constructor.
+	 */
+	PcaReport();
+
+	PcaSolver solver; /**< Solver used */
+	std::string reason; /**< Reason for choosing the solver */
+	std::vector<std::pair<std::string, double>> phase_seconds; /**< Time of every phase of the fit (seconds) */
+	double captured_variance; /**< Fraction of the total variance captured by the components */
+	double total_variance; /**< Total variance of the rows (sum of variances of all the dimensions) */
+};
+
+/**
+ * @brief Streaming accumulator of the mean and covariance matrix of rows.
+ * Memory is fixed (dim x dim doubles and a small batch of rows) and does not depend on the number of rows.
+ * Rows are added in batches (scatter matrix of a batch computed with one matrix product), partial accumulators
+ * computed by separate threads are merged with Merge().
+ */
+class CovarianceAccumulator {
+
+public:
+	/**
+	 * @brief CovarianceAccumulator constructor.
+	 * @param dim number of values in a row
+	 * @param batch_size number of rows buffered before they are added to the covariance
+	 */
+	explicit CovarianceAccumulator(int dim, int batch_size = 64);
+
+	/**
+	 * @brief Adding a single row.
+	 * @param row 1 x dim Mat (any depth, 1 channel)
+	 */
+	void Add(const cv::Mat& row);
+
+	/**
+	 * @brief Merging rows accumulated by another accumulator.
+	 * @param other accumulator with the same row size
+	 */
+	void Merge(CovarianceAccumulator& other);
+
+	/**
+	 * @brief Computing principal components (one symmetric eigen decomposition of the covariance matrix).
+	 * @param max_components maximum number of components (0 - not limited)
+	 * @param retained_variance fraction of variance retained by the components (0 - not used)
+	 * @returns pca with mean, eigenvectors (rows, CV_32F) and eigenvalues (descending) set
+	 */
+	cv::PCA Finish(int max_components, double retained_variance = 0);
+
+	/**
+	 * @brief Total variance (trace of the covariance matrix) of the rows added before the last Finish().
+	 */
+	double TotalVariance() const;
+
+	int64_t GetCount() const { return count + batch_rows; }
+	int GetDim() const { return dim; }
+
+private:
+	int dim; /**< Number of values in a row */
+	int64_t count; /**< Number of rows added to the covariance */
+	cv::Mat mean; /**< Mean row (1 x dim, CV_64F) */
+	cv::Mat scatter; /**< Sum of outer products of centered rows (dim x dim, CV_64F) */
+	cv::Mat batch; /**< Buffered rows (batch_size x dim, CV_64F) */
+	int batch_rows; /**< Number of buffered rows */
+
+	/**
+	 * @brief Adding buffered rows to the mean and the scatter matrix.
+	 */
+	void Flush();
+
+	/**
+	 * @brief Merging mean and scatter matrix of another set of rows (Chan et al. pairwise update).
+	 */
+	void MergeMoments(const cv::Mat& other_mean, const cv::Mat& other_scatter, int64_t other_count);
+};
+
+namespace pca_engine
+{
+	/**
+	 * Function returning row of the data (1 x dim Mat, any depth) with given index, called concurrently from worker threads.
+	 */
+	typedef std::function<cv::Mat(int)> RowSource;
+
+	/**
+	 * @brief Choosing the cheapest solver for the data size (when pca_auto is set in options).
+	 * @param num_rows number of rows
+	 * @param dim number of values in a row
+	 * @param options pca options
+	 * @param reason reason for the choice (output)
+	 */
+	PcaSolver SelectSolver(int num_rows, int dim, const PcaOptions& options, std::string& reason);
+
+	/**
+	 * @brief Calculating pca with the solver from options (or the automatically selected one).
+	 * @param num_rows number of rows
+	 * @param rows function returning rows
+	 * @param options pca options
+	 * @param report summary of the fit (output, may be nullptr)
+	 */
+	cv::PCA Fit(int num_rows, const RowSource& rows, const PcaOptions& options, PcaReport* report = nullptr);
+
+	/**
+	 * @brief Calculating pca with the covariance solver (rows streamed through per-thread CovarianceAccumulator objects).
+	 * @param num_rows number of rows
+	 * @param rows function returning rows
+	 * @param max_components maximum number of components (0 - not limited)
+	 * @param retained_variance fraction of variance retained by the components (0 - not used)
+	 * @param report summary of the fit (output, may be nullptr)
+	 */
+	cv::PCA FitCovariance(int num_rows, const RowSource& rows, int max_components, double retained_variance = 0, PcaReport* report = nullptr);
+
+	/**
+	 * @brief Calculating pca with the gram solver - eigen decomposition of the rows x rows gram matrix of centered rows,
+	 * computed in tiles of rows fitting in the memory left after the gram matrix. Cheaper than the covariance solver when dim > rows.
+	 * @param num_rows number of rows
+	 * @param rows function returning rows
+	 * @param max_components maximum number of components (0 - not limited)
+	 * @param retained_variance fraction of variance retained by the components (0 - not used)
+	 * @param memory_budget memory available for the gram matrix and a tile of rows (bytes)
+	 * @param report summary of the fit (output, may be nullptr)
+	 */
+	cv::PCA FitGram(int num_rows, const RowSource& rows, int max_components, double retained_variance, int64_t memory_budget,
+		PcaReport* report = nullptr);
+
+	/**
+	 * @brief Calculating pca with the randomized solver - subspace iteration on the covariance operator (Halko et al.),
+	 * every pass over the rows is a blocked matrix product computed in parallel.
+	 * @param num_rows number of rows
+	 * @param rows function returning rows
+	 * @param options pca options (components, retained variance, oversampling, power iterations, seed)
+	 * @param report summary of the fit (output, may be nullptr)
+	 */
+	cv::PCA FitRandomized(int num_rows, const RowSource& rows, const PcaOptions& options, PcaReport* report = nullptr);
+
+	/**
+	 * @brief Calculating exact pca out of core - rows are processed once and written to a scratch file, then the covariance
+	 * matrix is accumulated from tiles of centered rows mapped from the file one after another (next tile read ahead).
+	 * Memory: covariance matrix and its eigenvectors (2 x dim x dim doubles) and one tile - rest of the memory budget.
+	 * @param num_rows number of rows
+	 * @param rows function returning rows
+	 * @param options pca options (components, retained variance, memory budget, scratch directory)
+	 * @param report summary of the fit (output, may be nullptr)
+	 */
+	cv::PCA FitOutOfCore(int num_rows, const RowSource& rows, const PcaOptions& options, PcaReport* report = nullptr);
+
+	/**
+	 * @brief Calculating separate pca of every plane of the rows (e.g. luminance and chrominances) combined into one model -
+	 * means concatenated, every eigenvector non-zero only in the columns of its plane. Components of all the planes are
+	 * sorted by eigenvalue (descending), so the model can be truncated like a joint pca.
+	 * Every plane is fitted with the solver from options (or the automatically selected one), maximum number of components
+	 * is divided between the planes proportionally to their sizes.
+	 * @param num_rows number of rows
+	 * @param rows function returning rows
+	 * @param plane_sizes number of values of every plane (consecutive parts of a row)
+	 * @param options pca options
+	 * @param report summary of the fit (output, may be nullptr), solver is auto and the reason lists the solver of every plane
+	 */
+	cv::PCA FitPerPlane(int num_rows, const RowSource& rows, const std::vector<int>& plane_sizes, const PcaOptions& options,
+		PcaReport* report = nullptr);
+
+	/**
+	 * @brief Number of components retaining given fraction of variance.
+	 * @param eigenvalues eigenvalues in descending order (column vector)
+	 * @param retained_variance fraction of variance (0-1]
+	 * @param total_variance total variance of the data (0 - sum of the eigenvalues)
+	 */
+	int ComponentsForVariance(const cv::Mat& eigenvalues, double retained_variance, double total_variance = 0);
+
+	/**
+	 * @brief Random order of rows for subsampled fitting - first num_samples rows are the fit sample, the rest are in random order.
+	 * @param labels labels of the rows
+	 * @param num_samples size of the fit sample
+	 * @param stratified flag for the sample with the same proportions of labels as all the rows
+	 * @param seed seed of the random generator
+	 * @returns indices of all the rows
+	 */
+	std::vector<int> SampleRows(const std::vector<int>& labels, int num_samples, bool stratified, uint64_t seed);
+
+	/**
+	 * @brief Fraction of the variance of rows captured by the components (e.g. on rows held out from the fit).
+	 * @param pca pca model
+	 * @param num_rows number of rows
+	 * @param rows function returning rows
+	 */
+	double CapturedVariance(const cv::PCA& pca, int num_rows, const RowSource& rows);
+
+	/**
+	 * @brief Projecting a batch of rows onto the principal components (one matrix product for the whole batch).
+	 * @param pca pca model
+	 * @param rows batch of rows (batch size x dim, CV_32F)
+	 * @param projections projections of the rows (batch size x components, CV_32F)
+	 */
+	void Project(const cv::PCA& pca, const cv::Mat& rows, cv::Mat& projections);
+
+	/**
+	 * @brief Replacing eigenvectors of a pca model with the whitening matrix, so Project() gives whitened projections
+	 * with the same single matrix product. Mean and eigenvalues are not changed.
+	 * @param pca pca model (not whitened)
+	 * @param whitening type of whitening
+	 * @param epsilon value added to the eigenvalues
+	 * @returns pca model with eigenvectors replaced by the whitening matrix (components x dim for pca whitening, dim x dim for zca)
+	 */
+	cv::PCA Whiten(const cv::PCA& pca, PcaWhitening whitening, double epsilon);
+
+	/**
+	 * @brief Saving pca model (mean, eigenvalues, eigenvectors) to a binary file, arrays aligned to 64 bytes (memory-mappable).
+	 * @param path path where the file should be saved
+	 * @param pca pca model
+	 * @param whitening whitening applied to the model with Whiten() (eigenvectors are the whitening matrix)
+	 * @param epsilon value added to the eigenvalues in whitening
+	 */
+	void SaveModel(const std::string& path, const cv::PCA& pca, PcaWhitening whitening = no_whitening, double epsilon = 0);
+
+	/**
+	 * @brief Reading pca model saved with SaveModel() from a mapped file (without copying).
+	 * @param file mapped model file
+	 * @param whitening whitening applied to the saved model (output, may be nullptr)
+	 * @returns pca with Mats pointing to the mapped memory (valid as long as the file is mapped)
+	 * Throws an invalid argument error if the header is corrupted (an array out of the file, unknown whitening).
+	 */
+	cv::PCA LoadModel(const MappedFile& file, PcaWhitening* whitening = nullptr);
+
+	/**
+	 * @brief Name of a pca solver.
+	 */
+	std::string SolverName(PcaSolver solver);
+}
+
+#endif // !PCA_ENGINE_H
@@ -0,0 +1,80 @@
+/**
+* @file positional_file.cpp
+* @brief Implementation of PositionalFile class (concurrent writes at explicit offsets).
+*/
+
+#include "positional_file.h"
+#include <stdexcept>
+#include <cstring>
+
+using namespace std;
+
+namespace
+{
+	/**
+	 * Event of a writing thread, created with its first write and reused by all its writes (closed when the thread exits).
+	 */
+	struct ThreadEvent {
+		HANDLE handle;
+		ThreadEvent() : handle(CreateEventA(nullptr, TRUE, FALSE, nullptr)) {}
+		~ThreadEvent() { if (handle) CloseHandle(handle); }
+	};
+}
+
+/**
+ * Space for the whole file is reserved first (FileAllocationInfo, as contiguous as the file system allows), then the end of file is set.
+ * Valid data length is not moved (SetFileValidData would expose old disk contents), the file system zero-fills a region
+ * once when a write lands past the data written so far.
+ * Throws an invalid argument error when the file cannot be created and a runtime error when it cannot be resized.
+ */
+PositionalFile::PositionalFile(const string& path, int64_t size) : path(path), file(INVALID_HANDLE_VALUE), size(size)
+{
+	if (size < 0) throw invalid_argument("PositionalFile: size must not be negative");
+	file = CreateFileA(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED, nullptr);
+	if (file == INVALID_HANDLE_VALUE) throw invalid_argument("PositionalFile: file could not be opened: " + path);
+
+	FILE_ALLOCATION_INFO allocation;
+	allocation.AllocationSize.QuadPart = size;
+	FILE_END_OF_FILE_INFO end_of_file;
+	end_of_file.EndOfFile.QuadPart = size;
+	SetFileInformationByHandle(file, FileAllocationInfo, &allocation, sizeof(allocation));
+	if (!SetFileInformationByHandle(file, FileEndOfFileInfo, &end_of_file, sizeof(end_of_file))) {
+		Close();
+		throw runtime_error("PositionalFile: file could not be resized to " + to_string(size) + " bytes: " + path);
+	}
+}
+
+PositionalFile::~PositionalFile()
+{
+	Close();
+}
+
+/**
+ * Every thread waits on its own event, so concurrent calls do not wait for each other's requests
+ * and no event is created per write (a thread has one write in progress at a time).
+ */
+void PositionalFile::WriteAt(int64_t offset, const void* data, size_t size) const
+{
+	if (offset < 0 || offset + static_cast<int64_t>(size) > this->size) throw invalid_argument("WriteAt: write outside the file");
+	if (size == 0) return;
+
+	OVERLAPPED request;
+	memset(&request, 0, sizeof(request));
+	request.Offset = static_cast<DWORD>(offset & 0xFFFFFFFF);
+	request.OffsetHigh = static_cast<DWORD>(offset >> 32);
+	thread_local ThreadEvent event;
+	if (!event.handle) throw runtime_error("WriteAt: event could not be created");
+	request.hEvent = event.handle;
+	ResetEvent(request.hEvent);
+
+	DWORD written = 0;
+	bool success = WriteFile(file, data, static_cast<DWORD>(size), nullptr, &request) || GetLastError() == ERROR_IO_PENDING;
+	success = success && GetOverlappedResult(file, &request, &written, TRUE) && written == size;
+	if (!success) throw runtime_error("WriteAt: writing the file failed: " + path);
+}
+
+void PositionalFile::Close()
+{
+	if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+	file = INVALID_HANDLE_VALUE;
+}
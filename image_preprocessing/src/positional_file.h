@@ -0,0 +1,56 @@
+/**
+* @file positional_file.h
+* @brief Preallocated output file written at given offsets from many threads (PositionalFile class).
+*/
+
+#ifndef POSITIONAL_FILE_H
+#define POSITIONAL_FILE_H
+
+#include <string>
+#include <cstddef>
+#include <cstdint>
+#include <Windows.h>
+
+/**
+ * @brief Output file of a size known in advance, written at explicit offsets.
+ * The file is created with its final size, every write carries its own offset (overlapped WriteFile, the handle has no
+ * shared file pointer), so threads write their parts at the final positions concurrently, in any order, without locking.
+ * Parts that are never written read as zeros.
+ */
+class PositionalFile {
+
+public:
+	/**
+	 * @brief PositionalFile constructor - creating (or truncating) the file and setting its size.
+	 * @param path path to the file
+	 * @param size size of the file in bytes
+	 */
+	PositionalFile(const std::string& path, int64_t size);
+
+	~PositionalFile();
+
+	PositionalFile(const PositionalFile&) = delete;
+	PositionalFile& operator=(const PositionalFile&) = delete;
+
+	/**
+	 * @brief Writing data at an offset (thread-safe, returns when the data is written).
+	 * @param offset offset in the file
+	 * @param data pointer to the data
+	 * @param size number of bytes (offset + size must not exceed the size of the file)
+	 */
+	void WriteAt(int64_t offset, const void* data, size_t size) const;
+
+	/**
+	 * @brief Closing the file (no writes may be in progress).
+	 */
+	void Close();
+
+	int64_t GetSize() const { return size; }
+
+private:
+	std::string path; /**< Path to the file */
+	HANDLE file; /**< File handle (opened for overlapped writes) */
+	int64_t size; /**< Size of the file in bytes */
+};
+
+#endif // !POSITIONAL_FILE_H
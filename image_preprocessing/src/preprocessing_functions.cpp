@@ -5,18 +5,101 @@
  */
 
 #include "preprocessing_functions.h"
+#include <climits>
+#include <limits>
 using namespace cv;
 using namespace std;
 
 namespace preprocessing
 {
+	namespace
+	{
+		/**
+		 * Average of absolute horizontal and vertical 3x3 sobel derivatives saturated to max_value, result rounded half up
+		 * (integer derivatives are exact in float, 0.25 offset turns rounding to nearest into rounding half up).
+		 * Counterpart of the CV_8U sobel path for 16-bit images (CV_16S fixed point and CV_16U).
+		 */
+		void SobelMagnitude(Mat& img, int max_value)
+		{
+			if (img.rows < 2 || img.cols < 2) throw invalid_argument("Filter: image too small for sobel filter");
+			Mat sobel_x, sobel_y;
+			Sobel(img, sobel_x, CV_32F, 1, 0, 3);
+			Sobel(img, sobel_y, CV_32F, 0, 1, 3);
+			threshold(abs(sobel_x), sobel_x, max_value, 0, THRESH_TRUNC);
+			threshold(abs(sobel_y), sobel_y, max_value, 0, THRESH_TRUNC);
+			addWeighted(sobel_x, 0.5, sobel_y, 0.5, 0.25, img, img.depth());
+		}
+
+		/**
+		 * Table of 65536 entries, the entry of value v is at index v - numeric_limits<T>::min().
+		 * Operations are composed in double without rounding between them (the same as applying them pixel by pixel).
+		 */
+		template <typename T>
+		Mat ComposeTypedLut(const vector<PointwiseOperation>& operations, int max_value)
+		{
+			const int offset = (numeric_limits<T>::min)();
+			Mat lut(1, 65536, cv::DataType<T>::type);
+			T* table = lut.ptr<T>(0);
+			for (int i = 0; i < 65536; i++) {
+				double value = static_cast<double>(i + offset) / max_value;
+				for (auto& operation : operations) value = ApplyPointwise(value, operation);
+				table[i] = saturate_cast<T>(value * max_value);
+			}
+			return lut;
+		}
+
+		/**
+		 * Look-up table from ComposeTypedLut applied pixel by pixel (a single table read per pixel).
+		 */
+		template <typename T>
+		void ApplyTypedLut(Mat& img, const Mat& lut)
+		{
+			const int offset = (numeric_limits<T>::min)();
+			const T* table = lut.ptr<T>(0);
+			const int row_size = img.cols * img.channels();
+			for (int i = 0; i < img.rows; i++) {
+				T* row = img.ptr<T>(i);
+				for (int j = 0; j < row_size; j++) row[j] = table[row[j] - offset];
+			}
+		}
+	}
+
+	/**
+	 * Works only for CV_8U, otherwise throws an invalid argument error.
+	 */
+	void ConvertToFixedPoint(Mat& grayscale_img)
+	{
+		if (grayscale_img.depth() != CV_8U) throw invalid_argument("ConvertToFixedPoint: uncorrect Mat type (only CV_8U accepted)");
+		grayscale_img.convertTo(grayscale_img, CV_16S, 1 << fixed_point_bits);
+	}
+
 	/**
 	 * Filter processes 1-channel Mat. 
 	 * When a 3-channel Mat is passed, it is converted to grayscale and then processed.
+	 * CV_16S Mats are treated as fixed-point images: sobel saturates derivatives at fixed_point_max (as the 8-bit path at 255),
+	 * median filter is applied to values offset to CV_16U (order is preserved).
+	 * CV_16U Mats are filtered natively, sobel saturates derivatives at 65535.
 	 * Incorrect filter type should raise invalid argument error.
 	 */
 	void Filter(Mat& grayscale_img, const FilterType type) 
 	{
+		if (grayscale_img.depth() == CV_16U && type == sobel) {
+			SobelMagnitude(grayscale_img, USHRT_MAX);
+			return;
+		}
+
+		if (grayscale_img.depth() == CV_16S) {
+			if (type == sobel) SobelMagnitude(grayscale_img, fixed_point_max);
+			if (type == median) {
+				Mat offset_img;
+				grayscale_img.convertTo(offset_img, CV_16U, 1, 32768);
+				medianBlur(offset_img, offset_img, 5);
+				offset_img.convertTo(grayscale_img, CV_16S, 1, -32768);
+			}
+			if (type == gaussian) GaussianBlur(grayscale_img, grayscale_img, Size(5, 5), 0, 0);
+			return;
+		}
+
 		if (type == sobel) {
 			//Applying horizontal and vertical sobel filters and calculating the average.
 			Mat sobel_x, sobel_y;
@@ -37,24 +120,168 @@ namespace preprocessing
 
 	/**
 	 * Subtracting mean works for Mat with any number of channels and data type (CV_8U/ CV_32F)
+	 * For CV_16S (fixed point) results are rounded to nearest and negative values are kept (CV_8U saturates them to 0).
 	 */
 	void SubtractMean(Mat& grayscale_img) 
 	{
 		grayscale_img = grayscale_img - mean(grayscale_img);
 	}
 
+	/**
+	* Standardize processes 1-channel Mat.
+	* When a 3-channel Mat is passed, it is converted to grayscale and then processed.
+	* Conversion to CV_32F, subtraction and division are done in one pass. Constant images become all zeros.
+	*/
+	void Standardize(Mat& grayscale_img)
+	{
+		if (grayscale_img.channels() == 3) cvtColor(grayscale_img, grayscale_img, CV_BGR2GRAY);
+
+		Scalar mean_value, std_value;
+		meanStdDev(grayscale_img, mean_value, std_value);
+		const double scale = (std_value[0] > 1e-12) ? 1.0 / std_value[0] : 1.0;
+		grayscale_img.convertTo(grayscale_img, CV_32F, scale, -mean_value[0] * scale);
+	}
+
+	/**
+	* LocalContrastNormalize processes 1-channel Mat.
+	* When a 3-channel Mat is passed, it is converted to grayscale and then processed.
+	* Local sums are unnormalized box filters with zero borders divided by the window area inside the image,
+	* so windows are cropped at the image borders and the cost does not depend on the window size.
+	* Local std is bounded from below by its mean over the whole image (Jarrett et al.), so flat regions are not amplified.
+	* Throws an invalid argument error for even or non-positive window size.
+	*/
+	void LocalContrastNormalize(Mat& grayscale_img, int window_size)
+	{
+		if (window_size <= 0 || window_size % 2 == 0) throw invalid_argument("LocalContrastNormalize: window size must be odd and positive");
+		if (grayscale_img.channels() == 3) cvtColor(grayscale_img, grayscale_img, CV_BGR2GRAY);
+
+		// centered by the global mean (does not change the result), so float squared sums keep the local variance of bright images
+		Mat src;
+		grayscale_img.convertTo(src, CV_32F);
+		src -= mean(src);
+
+		const Size window(window_size, window_size);
+		Mat area, local_mean, local_std;
+		boxFilter(Mat::ones(src.size(), CV_32F), area, CV_32F, window, Point(-1, -1), false, BORDER_CONSTANT);
+		boxFilter(src, local_mean, CV_32F, window, Point(-1, -1), false, BORDER_CONSTANT);
+		sqrBoxFilter(src, local_std, CV_32F, window, Point(-1, -1), false, BORDER_CONSTANT);
+		divide(local_mean, area, local_mean);
+		divide(local_std, area, local_std);
+		local_std -= local_mean.mul(local_mean);
+		local_std.setTo(0, local_std < 0);
+		sqrt(local_std, local_std);
+
+		const double min_std = mean(local_std)[0];
+		local_std.setTo(min_std, local_std < min_std);
+		subtract(src, local_mean, grayscale_img);
+		divide(grayscale_img, local_std, grayscale_img);
+		grayscale_img.setTo(0, local_std <= 1e-12);
+	}
+
 	/**
 	* ConvertToNegative processes 1-channel Mat.
 	* When a 3-channel Mat is passed, it is converted to grayscale and then processed.
-	* Works for CV_8U (pixel values 0-255) and CV_32F (pixel values 0-1), otherwise throws an invalid argument error.
+	* Works for CV_8U (pixel values 0-255), CV_16U (pixel values 0-65535), CV_16S (fixed point, 0-fixed_point_max) and CV_32F (pixel values 0-1),
+	* otherwise throws an invalid argument error.
 	*/
 	void ConvertToNegative(Mat& grayscale_img)
 	{
 		if(grayscale_img.channels()==3) cvtColor(grayscale_img, grayscale_img, CV_BGR2GRAY);
 
 		if(grayscale_img.type()==CV_8U) grayscale_img = 255 - grayscale_img;
+		else if (grayscale_img.type() == CV_16U) grayscale_img = USHRT_MAX - grayscale_img;
+		else if (grayscale_img.type() == CV_16S) grayscale_img = fixed_point_max - grayscale_img;
 		else if (grayscale_img.type() == CV_32F) grayscale_img = 1 - grayscale_img;
-		else throw invalid_argument("Cannot convert to negative: uncorrect Mat type (only CV_8U and CV_32F accepted)");
+		else throw invalid_argument("Cannot convert to negative: uncorrect Mat type (only CV_8U, CV_16U, CV_16S and CV_32F accepted)");
+	}
+
+	/**
+	 * Throws an invalid argument error for incorrect operation parameters.
+	 */
+	double ApplyPointwise(double value, const PointwiseOperation& operation)
+	{
+		switch (operation.type) {
+		case negative_op:
+			return 1 - value;
+		case gamma_op:
+			if (operation.param1 <= 0) throw invalid_argument("ApplyPointwise: gamma exponent must be positive");
+			return pow(value, operation.param1);
+		case contrast_op:
+			if (operation.param2 <= operation.param1) throw invalid_argument("ApplyPointwise: contrast stretch upper bound must be greater than lower bound");
+			return min(1.0, max(0.0, (value - operation.param1) / (operation.param2 - operation.param1)));
+		case clamp_op:
+			return min(operation.param2, max(operation.param1, value));
+		case threshold_op:
+			return (value > operation.param1) ? 1.0 : 0.0;
+		default:
+			throw invalid_argument("ApplyPointwise: unknown pointwise operation type");
+		}
+	}
+
+	/**
+	 * Every operation is evaluated on the 256 possible values and rounded to 8 bits,
+	 * so the composed table gives exactly the same result as applying the operations one by one.
+	 */
+	Mat ComposeLut(const vector<PointwiseOperation>& operations)
+	{
+		Mat lut(1, 256, CV_8U);
+		uchar* table = lut.ptr<uchar>(0);
+		for (int i = 0; i < 256; i++) table[i] = static_cast<uchar>(i);
+
+		for (auto& operation : operations) {
+			uchar operation_table[256];
+			for (int i = 0; i < 256; i++) operation_table[i] = saturate_cast<uchar>(ApplyPointwise(i / 255.0, operation) * 255);
+			for (int i = 0; i < 256; i++) table[i] = operation_table[table[i]];
+		}
+		return lut;
+	}
+
+	/**
+	 * Fixed-point images (CV_16S) use fixed_point_max as 1, CV_16U images 65535, other depths throw an invalid argument error.
+	 */
+	Mat ComposeLut16(const vector<PointwiseOperation>& operations, int depth)
+	{
+		if (depth == CV_16S) return ComposeTypedLut<short>(operations, fixed_point_max);
+		if (depth == CV_16U) return ComposeTypedLut<ushort>(operations, USHRT_MAX);
+		throw invalid_argument("ComposeLut16: uncorrect depth (only CV_16S and CV_16U accepted)");
+	}
+
+	/**
+	 * 8-bit tables are applied with cv::LUT, 16-bit tables by indexing with pixel values (table depth has to match the image).
+	 * Other types throw an invalid argument error.
+	 */
+	void ApplyLut(Mat& grayscale_img, const Mat& lut)
+	{
+		if (grayscale_img.depth() == CV_8U) LUT(grayscale_img, lut, grayscale_img);
+		else if (grayscale_img.depth() == CV_16S && lut.type() == CV_16S && lut.total() == 65536) ApplyTypedLut<short>(grayscale_img, lut);
+		else if (grayscale_img.depth() == CV_16U && lut.type() == CV_16U && lut.total() == 65536) ApplyTypedLut<ushort>(grayscale_img, lut);
+		else throw invalid_argument("ApplyLut: uncorrect Mat type (only CV_8U, CV_16S and CV_16U with a table of the same depth accepted)");
+	}
+
+	/**
+	 * CV_8U, CV_16S (fixed point) and CV_16U images go through one composed look-up table (integers rounded to nearest),
+	 * CV_32F (pixel values 0-1) are processed pixel by pixel. Other types throw an invalid argument error.
+	 * Repeated calls compose the table every time, Image keeps the composed tables of its configuration.
+	 */
+	void ApplyPointwise(Mat& grayscale_img, const vector<PointwiseOperation>& operations)
+	{
+		if (operations.empty()) return;
+
+		if (grayscale_img.depth() == CV_8U) ApplyLut(grayscale_img, ComposeLut(operations));
+		else if (grayscale_img.depth() == CV_32F) {
+			for (int i = 0; i < grayscale_img.rows; i++) {
+				float* row = grayscale_img.ptr<float>(i);
+				for (int j = 0; j < grayscale_img.cols * grayscale_img.channels(); j++) {
+					double value = row[j];
+					for (auto& operation : operations) value = ApplyPointwise(value, operation);
+					row[j] = static_cast<float>(value);
+				}
+			}
+		}
+		else if (grayscale_img.depth() == CV_16S || grayscale_img.depth() == CV_16U) {
+			ApplyLut(grayscale_img, ComposeLut16(operations, grayscale_img.depth()));
+		}
+		else throw invalid_argument("ApplyPointwise: uncorrect Mat type (only CV_8U, CV_16S, CV_16U and CV_32F accepted)");
 	}
 
 	/**
@@ -146,4 +373,22 @@ namespace preprocessing
 		return psnr;
 		
 	}
-}
\ No newline at end of file
+
+	/**
+	 * OpenCV 3.2 parallel_for_ accepts only ParallelLoopBody objects, the wrapper adapts a std::function.
+	 */
+	class FunctionLoopBody : public ParallelLoopBody
+	{
+	public:
+		explicit FunctionLoopBody(function<void(const Range&)> body) : body(move(body)) {}
+		void operator()(const Range& range) const override { body(range); }
+
+	private:
+		function<void(const Range&)> body;
+	};
+
+	void ParallelFor(const Range& range, function<void(const Range&)> body, double nstripes)
+	{
+		parallel_for_(range, FunctionLoopBody(move(body)), nstripes);
+	}
+}
@@ -11,6 +11,7 @@
 #include <opencv2/imgproc/imgproc.hpp>
 #include <iostream>
 #include <fstream>
+#include <functional>
 
 /**
  *  Enum for available types of filters.
@@ -22,6 +23,27 @@ enum FilterType {
 	median = 'm'
 };
 
+/**
+ *  Enum for available types of pointwise operations (applied to pixel values normalized to 0-1).
+ *  Default char values for easier commandline arguments parsing.
+ */
+enum PointwiseType {
+	negative_op = 'n',
+	gamma_op = 'g',
+	contrast_op = 'c',
+	clamp_op = 'l',
+	threshold_op = 't'
+};
+
+/**
+*  Struct describing a single pointwise operation.
+*/
+struct PointwiseOperation {
+	PointwiseType type;
+	double param1; /**< gamma exponent / lower bound (contrast stretch, clamp) / threshold value */
+	double param2; /**< upper bound (contrast stretch, clamp) */
+};
+
 /**
 *  Struct containing both chrominances.
 */
@@ -40,6 +62,19 @@ struct YuvImage {
 
 namespace preprocessing
 {
+	/**
+	 * Fixed-point representation of 8-bit images: CV_16S with fixed_point_bits fraction bits (pixel value 255 -> fixed_point_max).
+	 * All fixed-point stages round to nearest and saturate to the int16 range.
+	 */
+	const int fixed_point_bits = 4;
+	const int fixed_point_max = 255 << fixed_point_bits;
+
+	/**
+	 * @brief Converting an 8-bit image to fixed-point representation (CV_16S).
+	 * @param grayscale_img input image (CV_8U), modified in the function
+	 */
+	void ConvertToFixedPoint(cv::Mat& grayscale_img);
+
 	/**
 	 * @brief Filtering grayscale image.
 	 * @param grayscale_img input image (cv::Mat), modified in the function 
@@ -53,12 +88,62 @@ namespace preprocessing
 	*/
 	void SubtractMean(cv::Mat& grayscale_img);
 
+	/**
+	* @brief Per-image standardization - subtracting mean value and dividing by standard deviation of the image.
+	* @param grayscale_img input image (cv::Mat), modified in the function (result is CV_32F)
+	*/
+	void Standardize(cv::Mat& grayscale_img);
+
+	/**
+	* @brief Local contrast normalization - subtracting local mean and dividing by local standard deviation (square window).
+	* @param grayscale_img input image (cv::Mat), modified in the function (result is CV_32F)
+	* @param window_size size of the window side (odd, window is cropped at image borders)
+	*/
+	void LocalContrastNormalize(cv::Mat& grayscale_img, int window_size);
+
 	/**
 	* @brief Total inversion of pixel values in a grayscale image (negative image)
 	* @param grayscale_img input image (cv::Mat), modified in the function
 	*/
 	void ConvertToNegative(cv::Mat& grayscale_img);
 
+	/**
+	* @brief Applying a single pointwise operation to a normalized pixel value.
+	* @param value pixel value (0-1)
+	* @param operation pointwise operation
+	* @returns result of the operation (0-1)
+	*/
+	double ApplyPointwise(double value, const PointwiseOperation& operation);
+
+	/**
+	* @brief Composing consecutive pointwise operations on 8-bit images into one look-up table.
+	* @param operations pointwise operations (in order)
+	* @returns look-up table (1x256 CV_8U Mat)
+	*/
+	cv::Mat ComposeLut(const std::vector<PointwiseOperation>& operations);
+
+	/**
+	* @brief Composing consecutive pointwise operations on 16-bit images into one look-up table.
+	* @param operations pointwise operations (in order)
+	* @param depth depth of the images (CV_16S fixed point or CV_16U)
+	* @returns look-up table (1x65536 Mat of the given depth, value v at index v + 32768 for CV_16S, v for CV_16U)
+	*/
+	cv::Mat ComposeLut16(const std::vector<PointwiseOperation>& operations, int depth);
+
+	/**
+	* @brief Applying a look-up table to an 8-bit or 16-bit image.
+	* @param grayscale_img input image (CV_8U, CV_16S or CV_16U), modified in the function
+	* @param lut look-up table (1x256 CV_8U Mat or 1x65536 Mat from ComposeLut16 of the image depth)
+	*/
+	void ApplyLut(cv::Mat& grayscale_img, const cv::Mat& lut);
+
+	/**
+	* @brief Applying consecutive pointwise operations to an image.
+	* @param grayscale_img input image (cv::Mat), modified in the function
+	* @param operations pointwise operations (in order)
+	*/
+	void ApplyPointwise(cv::Mat& grayscale_img, const std::vector<PointwiseOperation>& operations);
+
 	/**
 	 * @brief Converting a BGR image to YUV (chrominances decimated 2x2)
 	 * @param input_img BGR (3-channel) image (cv::Mat)
@@ -95,6 +180,14 @@ namespace preprocessing
 	 */
 	void Normalize8Bit(cv::Mat& input);
 
+	/**
+	 * @brief Running a function in parallel on subranges of a range (cv::parallel_for_ wrapper accepting lambdas)
+	 * @param range range of indices to be processed
+	 * @param body function processing a subrange, called concurrently from worker threads
+	 * @param nstripes number of subranges the range is split into (-1 - one per index)
+	 */
+	void ParallelFor(const cv::Range& range, std::function<void(const cv::Range&)> body, double nstripes = -1.);
+
 }
 
 #endif // !PREPROCESSING_FUNCTIONS_H
\ No newline at end of file
@@ -0,0 +1,91 @@
+/**
+* @file random_projection.cpp
+* @brief Implementation of SparseRandomProjection class.
+*/
+
+#include "random_projection.h"
+#include <opencv2/core/hal/intrin.hpp>
+#include <random>
+#include <stdexcept>
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+using namespace cv;
+
+namespace
+{
+	/**
+	 * Adding (or subtracting) a row of floats to the accumulated row, 8 values per iteration.
+	 */
+	void AccumulateRow(const float* src, float* dst, int n, bool subtract)
+	{
+		int j = 0;
+#if CV_SIMD128
+		if (subtract) {
+			for (; j <= n - 8; j += 8) {
+				v_store(dst + j, v_load(dst + j) - v_load(src + j));
+				v_store(dst + j + 4, v_load(dst + j + 4) - v_load(src + j + 4));
+			}
+		}
+		else {
+			for (; j <= n - 8; j += 8) {
+				v_store(dst + j, v_load(dst + j) + v_load(src + j));
+				v_store(dst + j + 4, v_load(dst + j + 4) + v_load(src + j + 4));
+			}
+		}
+#endif
+		if (subtract) for (; j < n; j++) dst[j] -= src[j];
+		else for (; j < n; j++) dst[j] += src[j];
+	}
+}
+
+/**
+ * Entries are drawn from raw 64-bit outputs of the generator (top 53 bits - uniform value, lowest bit - sign),
+ * so the matrix does not depend on the standard library implementation of distributions.
+ */
+SparseRandomProjection::SparseRandomProjection(int dim, int components, uint64_t seed, double density) : dim(dim), components(components)
+{
+	if (dim <= 0 || components <= 0) throw invalid_argument("SparseRandomProjection: dimension and number of components must be positive");
+	if (density <= 0) density = 1.0 / sqrt(static_cast<double>(dim));
+	if (density > 1) throw invalid_argument("SparseRandomProjection: density must be in (0, 1]");
+	scale = static_cast<float>(sqrt(1.0 / (density * components)));
+
+	mt19937_64 generator(seed);
+	vector<int> negative;
+	offsets.push_back(0);
+	for (int c = 0; c < components; c++) {
+		negative.clear();
+		for (int j = 0; j < dim; j++) {
+			const uint64_t value = generator();
+			if ((value >> 11) * (1.0 / 9007199254740992.0) >= density) continue;
+			if (value & 1) negative.push_back(j);
+			else columns.push_back(j);
+		}
+		num_positive.push_back(static_cast<int>(columns.size()) - offsets.back());
+		columns.insert(columns.end(), negative.begin(), negative.end());
+		offsets.push_back(static_cast<int>(columns.size()));
+	}
+}
+
+/**
+ * Batch is transposed, so every nonzero entry adds one contiguous row of batch size values (vectorized) to the
+ * accumulated component - values of a column are read once per entry for the whole batch.
+ */
+void SparseRandomProjection::Project(const Mat& rows, Mat& projections) const
+{
+	if (rows.type() != CV_32F || rows.cols != dim) throw invalid_argument("Project: rows must be CV_32F with " + to_string(dim) + " values");
+
+	Mat rows_t;
+	transpose(rows, rows_t);
+	Mat projections_t(components, rows.rows, CV_32F);
+	for (int c = 0; c < components; c++) {
+		float* accumulated = projections_t.ptr<float>(c);
+		fill(accumulated, accumulated + rows.rows, 0.f);
+		for (int k = offsets[c]; k < offsets[c + 1]; k++) {
+			AccumulateRow(rows_t.ptr<float>(columns[k]), accumulated, rows.rows, k >= offsets[c] + num_positive[c]);
+		}
+	}
+	transpose(projections_t, projections);
+	projections *= scale;
+}
@@ -0,0 +1,50 @@
+/**
+* @file random_projection.h
+* @brief Sparse random projection (SparseRandomProjection class) - dimensionality reduction without fitting.
+*/
+
+#ifndef RANDOM_PROJECTION_H
+#define RANDOM_PROJECTION_H
+
+#include <opencv2/core/core.hpp>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @brief Sparse random projection (Achlioptas, Li et al. "Very sparse random projections").
+ * Entries of the projection matrix are +-sqrt(1 / (density * components)) with probability density / 2 each and 0 otherwise.
+ * The matrix is generated from the seed (the same seed, dimension and density give the same projection), only columns
+ * of the nonzero entries are kept - projecting is a sum of selected values, without multiplications.
+ */
+class SparseRandomProjection {
+
+public:
+	/**
+	 * @brief SparseRandomProjection constructor - generating the nonzero entries.
+	 * @param dim number of values in a row
+	 * @param components number of values of a projected row
+	 * @param seed seed of the random generator
+	 * @param density fraction of nonzero entries (0 - 1 / sqrt(dim), Li et al.)
+	 */
+	SparseRandomProjection(int dim, int components, uint64_t seed, double density = 0);
+
+	/**
+	 * @brief Projecting a batch of rows.
+	 * @param rows batch of rows (batch size x dim, CV_32F)
+	 * @param projections projections of the rows (batch size x components, CV_32F)
+	 */
+	void Project(const cv::Mat& rows, cv::Mat& projections) const;
+
+	int GetDim() const { return dim; }
+	int GetComponents() const { return components; }
+
+private:
+	int dim; /**< Number of values in a row */
+	int components; /**< Number of values of a projected row */
+	float scale; /**< Absolute value of the nonzero entries */
+	std::vector<int> columns; /**< Columns of the nonzero entries, for every component positive entries followed by negative ones */
+	std::vector<int> offsets; /**< Index of the first entry of every component in columns (components + 1 values) */
+	std::vector<int> num_positive; /**< Number of positive entries of every component */
+};
+
+#endif // !RANDOM_PROJECTION_H
@@ -0,0 +1,105 @@
+/**
+* @file scratch_matrix.cpp
+* @brief Implementation of ScratchMatrix class (temporary file mapped tile by tile).
+*/
+
+#include "scratch_matrix.h"
+#include <stdexcept>
+
+using namespace std;
+using namespace cv;
+
+namespace
+{
+	const size_t row_alignment = 64;
+
+	/**
+	 * Granularity of the offsets of mapped views (usually 64 kB).
+	 */
+	size_t AllocationGranularity()
+	{
+		SYSTEM_INFO info;
+		GetSystemInfo(&info);
+		return info.dwAllocationGranularity;
+	}
+}
+
+ScratchMatrix::Tile::~Tile()
+{
+	if (view) UnmapViewOfFile(view);
+}
+
+/**
+ * PrefetchVirtualMemory (Windows 8 and later) only queues the reads, so the next tile is loaded while the current one is processed.
+ */
+void ScratchMatrix::Tile::Prefetch() const
+{
+#if defined(_WIN32_WINNT_WIN8) && _WIN32_WINNT >= _WIN32_WINNT_WIN8
+	WIN32_MEMORY_RANGE_ENTRY range;
+	range.VirtualAddress = view;
+	range.NumberOfBytes = view_size;
+	PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#endif
+}
+
+/**
+ * The file is opened for sequential access, marked as temporary (kept in the file cache if memory allows) and deleted on close.
+ * Throws an invalid argument error when the file cannot be created and a runtime error when it cannot be resized or mapped.
+ */
+ScratchMatrix::ScratchMatrix(int rows, int cols, const string& directory) : rows(rows), cols(cols),
+	row_step((cols * sizeof(float) + row_alignment - 1) / row_alignment * row_alignment), file(INVALID_HANDLE_VALUE), mapping(nullptr)
+{
+	if (rows <= 0 || cols <= 0) throw invalid_argument("ScratchMatrix: number of rows and columns must be positive");
+
+	char temp_directory[MAX_PATH];
+	if (directory.empty() && !GetTempPathA(MAX_PATH, temp_directory)) throw runtime_error("ScratchMatrix: temporary directory not found");
+	char path[MAX_PATH];
+	if (!GetTempFileNameA(directory.empty() ? temp_directory : directory.c_str(), "pca", 0, path)) {
+		throw invalid_argument("ScratchMatrix: temporary file could not be created in: " + directory);
+	}
+
+	file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+		FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE) throw invalid_argument("ScratchMatrix: temporary file could not be opened: " + string(path));
+
+	LARGE_INTEGER size;
+	size.QuadPart = static_cast<LONGLONG>(row_step) * rows;
+	mapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE, size.HighPart, size.LowPart, nullptr);
+	if (!mapping) {
+		Close();
+		throw runtime_error("ScratchMatrix: temporary file could not be mapped (" + to_string(size.QuadPart) + " bytes)");
+	}
+}
+
+ScratchMatrix::~ScratchMatrix()
+{
+	Close();
+}
+
+/**
+ * View starts at the allocation granularity boundary preceding the first row.
+ */
+unique_ptr<ScratchMatrix::Tile> ScratchMatrix::MapTile(int begin, int count) const
+{
+	if (begin < 0 || count <= 0 || begin + count > rows) throw invalid_argument("MapTile: rows out of range");
+
+	static const size_t granularity = AllocationGranularity();
+	const uint64_t offset = static_cast<uint64_t>(row_step) * begin;
+	const uint64_t view_offset = offset / granularity * granularity;
+	const size_t view_size = static_cast<size_t>(offset - view_offset + row_step * count);
+
+	void* view = MapViewOfFile(mapping, FILE_MAP_READ | FILE_MAP_WRITE, static_cast<DWORD>(view_offset >> 32),
+		static_cast<DWORD>(view_offset & 0xFFFFFFFF), view_size);
+	if (!view) throw runtime_error("MapTile: rows could not be mapped");
+
+	Mat tile_rows(count, cols, CV_32F, static_cast<char*>(view) + (offset - view_offset), row_step);
+	return make_unique<Tile>(view, view_size, tile_rows);
+}
+
+void ScratchMatrix::Close()
+{
+	if (mapping) CloseHandle(mapping);
+	if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+	mapping = nullptr;
+	file = INVALID_HANDLE_VALUE;
+}
@@ -0,0 +1,91 @@
+/**
+* @file scratch_matrix.h
+* @brief Matrix of float rows kept in a temporary file (ScratchMatrix class).
+*/
+
+#ifndef SCRATCH_MATRIX_H
+#define SCRATCH_MATRIX_H
+
+#include <opencv2/core/core.hpp>
+#include <memory>
+#include <string>
+#include <Windows.h>
+
+/**
+ * @brief Matrix of float rows stored in a temporary file (deleted when the matrix is destroyed).
+ * Rows are accessed through tiles - consecutive rows mapped into memory, so the memory used is bounded by the tile size
+ * and not by the size of the matrix. Every row starts at a multiple of 64 bytes.
+ */
+class ScratchMatrix {
+
+public:
+	/**
+	 * @brief Consecutive rows of the matrix mapped into memory (unmapped when the tile is destroyed).
+	 */
+	class Tile {
+
+	public:
+		/**
+		 * @brief Tile constructor.
+		 * @param view pointer to the mapped view
+		 * @param view_size size of the mapped view in bytes
+		 * @param rows header of the rows inside the view (CV_32F)
+		 */
+		Tile(void* view, size_t view_size, cv::Mat rows) : view(view), view_size(view_size), rows(rows) {}
+
+		~Tile();
+
+		Tile(const Tile&) = delete;
+		Tile& operator=(const Tile&) = delete;
+
+		/**
+		 * @brief Requesting the pages of the tile from the file in the background (asynchronous read-ahead).
+		 */
+		void Prefetch() const;
+
+		const cv::Mat& GetRows() const { return rows; }
+
+	private:
+		void* view; /**< Pointer to the mapped view */
+		size_t view_size; /**< Size of the mapped view in bytes */
+		cv::Mat rows; /**< Header of the rows (points to the mapped view) */
+	};
+
+	/**
+	 * @brief ScratchMatrix constructor - creating the temporary file of the matrix size.
+	 * @param rows number of rows
+	 * @param cols number of values in a row
+	 * @param directory directory of the temporary file (empty - system temporary directory)
+	 */
+	ScratchMatrix(int rows, int cols, const std::string& directory = "");
+
+	~ScratchMatrix();
+
+	ScratchMatrix(const ScratchMatrix&) = delete;
+	ScratchMatrix& operator=(const ScratchMatrix&) = delete;
+
+	/**
+	 * @brief Mapping consecutive rows into memory (tiles can be mapped concurrently from worker threads).
+	 * @param begin index of the first row
+	 * @param count number of rows
+	 */
+	std::unique_ptr<Tile> MapTile(int begin, int count) const;
+
+	int GetRows() const { return rows; }
+	int GetCols() const { return cols; }
+	size_t GetRowStep() const { return row_step; }
+
+private:
+	int rows; /**< Number of rows */
+	int cols; /**< Number of values in a row */
+	size_t row_step; /**< Distance between rows in bytes (multiple of 64) */
+	HANDLE file; /**< File handle (file deleted on close) */
+	HANDLE mapping; /**< File mapping handle */
+
+	/**
+	 * @brief Closing the handles (file is deleted by the system).
+	 */
+	void Close();
+};
+
+#endif // !SCRATCH_MATRIX_H
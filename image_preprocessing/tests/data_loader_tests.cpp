@@ -5,6 +5,8 @@
 
 #include "Catch.h"
 #include "../../image_preprocessing/src/data_loader.h"
+#include <iterator>
+#include <algorithm>
 using namespace std;
 using namespace cv;
 
@@ -62,3 +64,153 @@ TEST_CASE("When there are 50 files in the folders then ReadData() returns 50") {
 	REQUIRE(data_loader.ReadData() == 50);
 	REQUIRE(data_loader.GetNumImages() == 50);
 }
+
+TEST_CASE("When there are no images then saving quantized data throws an exception") {
+	ProcessingConfiguration cfg;
+	cfg.format = CV_LOAD_IMAGE_GRAYSCALE;
+	Image::SetCfg(cfg);
+
+	DataLoader data_loader("../../image_preprocessing/tests/samples/50/", 5, cfg);
+	OutputConfiguration out_cfg;
+	out_cfg.dtype = uint8;
+
+	REQUIRE_THROWS_AS(data_loader.SaveFormattedData("empty_quantized.bin", out_cfg), runtime_error);
+}
+
+TEST_CASE("Data saved in version 2 format should be read the same as in version 1 format") {
+	ProcessingConfiguration cfg;
+	cfg.format = CV_LOAD_IMAGE_GRAYSCALE;
+	Image::SetCfg(cfg);
+
+	DataLoader data_loader("../../image_preprocessing/tests/samples/50/", 5, cfg);
+	data_loader.ReadData();
+	OutputConfiguration out_cfg;
+	out_cfg.dtype = uint8;
+	out_cfg.format_version = 2;
+	data_loader.SaveFormattedData("dataset_v2_test.bin", out_cfg);
+	out_cfg.format_version = 1;
+	data_loader.SaveFormattedData("dataset_v1_test.bin", out_cfg);
+
+	vector<vector<float>> data_v1, data_v2;
+	vector<int> labels_v1, labels_v2;
+	DataLoader::ReadVector("dataset_v1_test.bin", data_v1, labels_v1);
+	DataLoader::ReadVector("dataset_v2_test.bin", data_v2, labels_v2);
+
+	REQUIRE(data_v2.size() == 50);
+	REQUIRE(data_v2 == data_v1);
+	REQUIRE(labels_v2 == labels_v1);
+
+	ifstream file("dataset_v2_test.bin", ios::binary);
+	DatasetHeader header;
+	file.read(reinterpret_cast<char*>(&header), sizeof(header));
+	REQUIRE(header.record_size == static_cast<int>(data_v2.front().size()));
+	REQUIRE(header.data_offset % 64 == 0);
+	REQUIRE(header.offsets_offset == 0);
+}
+
+TEST_CASE("Data saved in batches should be the same as data saved at once") {
+	ProcessingConfiguration cfg;
+	cfg.format = CV_LOAD_IMAGE_GRAYSCALE;
+	Image::SetCfg(cfg);
+
+	// separate loaders, so the batched save does not reuse formatted data cached by the save at once
+	OutputConfiguration out_cfg;
+	out_cfg.dtype = int8;
+	out_cfg.batch_size = 7;
+	DataLoader batches_loader("../../image_preprocessing/tests/samples/50/", 5, cfg);
+	batches_loader.ReadData();
+	batches_loader.SaveFormattedData("dataset_batches_test.bin", out_cfg);
+	out_cfg.batch_size = 0;
+	DataLoader cached_loader("../../image_preprocessing/tests/samples/50/", 5, cfg);
+	cached_loader.ReadData();
+	cached_loader.SaveFormattedData("dataset_cached_test.bin", out_cfg);
+
+	vector<vector<float>> data_cached, data_batches;
+	vector<int> labels_cached, labels_batches;
+	DataLoader::ReadVector("dataset_cached_test.bin", data_cached, labels_cached);
+	DataLoader::ReadVector("dataset_batches_test.bin", data_batches, labels_batches);
+
+	REQUIRE(data_batches.size() == 50);
+	REQUIRE(data_batches == data_cached);
+	REQUIRE(labels_batches == labels_cached);
+}
+
+TEST_CASE("Data written in parallel at precomputed offsets should be identical to data written sequentially") {
+	ProcessingConfiguration cfg;
+	cfg.format = CV_LOAD_IMAGE_GRAYSCALE;
+	Image::SetCfg(cfg);
+
+	DataLoader data_loader("../../image_preprocessing/tests/samples/50/", 5, cfg);
+	data_loader.ReadData();
+	OutputConfiguration out_cfg;
+	out_cfg.dtype = uint8;
+	out_cfg.batch_size = 7;
+	out_cfg.format_version = 2;
+	data_loader.SaveFormattedData("dataset_sequential_test.bin", out_cfg);
+	out_cfg.parallel_write = true;
+	data_loader.SaveFormattedData("dataset_parallel_test.bin", out_cfg);
+
+	ifstream sequential("dataset_sequential_test.bin", ios::binary);
+	ifstream parallel("dataset_parallel_test.bin", ios::binary);
+	const vector<char> sequential_bytes((istreambuf_iterator<char>(sequential)), istreambuf_iterator<char>());
+	const vector<char> parallel_bytes((istreambuf_iterator<char>(parallel)), istreambuf_iterator<char>());
+	REQUIRE(!sequential_bytes.empty());
+	REQUIRE(parallel_bytes == sequential_bytes);
+}
+
+TEST_CASE("When parallel writes are chosen for version 1 files then SaveFormattedData() throws invalid argument error") {
+	ProcessingConfiguration cfg;
+	cfg.format = CV_LOAD_IMAGE_GRAYSCALE;
+	Image::SetCfg(cfg);
+
+	DataLoader data_loader("../../image_preprocessing/tests/samples/50/", 5, cfg);
+	OutputConfiguration out_cfg;
+	out_cfg.format_version = 1;
+	out_cfg.parallel_write = true;
+
+	REQUIRE_THROWS_AS(data_loader.SaveFormattedData("dataset_parallel_v1_test.bin", out_cfg), invalid_argument);
+}
+
+TEST_CASE("Balanced shards should contain all the images with every category split evenly") {
+	ProcessingConfiguration cfg;
+	cfg.format = CV_LOAD_IMAGE_GRAYSCALE;
+	Image::SetCfg(cfg);
+
+	DataLoader data_loader("../../image_preprocessing/tests/samples/50/", 5, cfg);
+	data_loader.ReadData();
+	OutputConfiguration out_cfg;
+	data_loader.SaveFormattedData("dataset_whole_test.bin", out_cfg);
+	out_cfg.shards = 3;
+	out_cfg.balanced_shards = true;
+	data_loader.SaveFormattedData("dataset_sharded_test.bin", out_cfg);
+
+	vector<vector<float>> data_whole;
+	vector<int> labels_whole;
+	DataLoader::ReadVector("dataset_whole_test.bin", data_whole, labels_whole);
+
+	const auto shards = dataset_file::ReadShardIndex("dataset_sharded_test.bin.index");
+	REQUIRE(shards.size() == 3);
+	REQUIRE(shards[1].path == "dataset_sharded_test-00001-of-00003.bin");
+
+	vector<vector<float>> data_shards;
+	vector<int> labels_shards;
+	for (auto& shard : shards) {
+		vector<vector<float>> data;
+		vector<int> labels;
+		DataLoader::ReadVector(shard.path, data, labels);
+		REQUIRE(static_cast<int64_t>(data.size()) == shard.num_records);
+		REQUIRE((data.size() == 16 || data.size() == 17));
+		for (int label = 0; label < 5; label++) {
+			const auto label_count = count(labels.begin(), labels.end(), label);
+			const auto total_count = count(labels_whole.begin(), labels_whole.end(), label);
+			REQUIRE(label_count >= total_count / 3);
+			REQUIRE(label_count <= (total_count + 2) / 3);
+		}
+		data_shards.insert(data_shards.end(), data.begin(), data.end());
+		labels_shards.insert(labels_shards.end(), labels.begin(), labels.end());
+	}
+	sort(data_shards.begin(), data_shards.end());
+	sort(data_whole.begin(), data_whole.end());
+	REQUIRE(data_shards == data_whole);
+	REQUIRE(data_loader.GetNumImages() == 50);
+}
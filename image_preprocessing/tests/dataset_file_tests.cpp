@@ -0,0 +1,129 @@
+/**
+* @file dataset_file_tests.cpp
+* @brief Unit tests for dataset file format functions.
+*/
+
+#include "Catch.h"
+#include "../../image_preprocessing/src/dataset_file.h"
+#include <vector>
+#include <cmath>
+#include <limits>
+#include <sstream>
+#include <fstream>
+using namespace std;
+
+TEST_CASE("FloatToBfloat16() should round to nearest even") {
+	REQUIRE(dataset_file::FloatToBfloat16(1.0f) == 0x3F80);
+	REQUIRE(dataset_file::Bfloat16ToFloat(dataset_file::FloatToBfloat16(1.0f + 1.0f / 256)) == 1.0f);
+	REQUIRE(dataset_file::Bfloat16ToFloat(dataset_file::FloatToBfloat16(1.0f + 3.0f / 256)) == 1.0f + 4.0f / 256);
+	REQUIRE(std::isnan(dataset_file::Bfloat16ToFloat(dataset_file::FloatToBfloat16(numeric_limits<float>::quiet_NaN()))));
+}
+
+TEST_CASE("When floats are converted to half precision and back then relative error is small") {
+	vector<float> values(19);
+	for (size_t i = 0; i < values.size(); i++) values[i] = static_cast<float>(i) / 19 - 0.3f;
+
+	for (auto dtype : { float16, bfloat16 }) {
+		vector<char> buffer(values.size() * dataset_file::ElementSize(dtype));
+		vector<float> restored(values.size());
+		dataset_file::ConvertFromFloat(values.data(), buffer.data(), values.size(), dtype);
+		dataset_file::ConvertToFloat(buffer.data(), restored.data(), values.size(), dtype);
+
+		const double tolerance = (dtype == float16) ? 1e-3 : 1e-2;
+		for (size_t i = 0; i < values.size(); i++) REQUIRE(fabs(restored[i] - values[i]) <= tolerance * fabs(values[i]) + 1e-6);
+	}
+}
+
+TEST_CASE("When 8-bit pixels scaled by 1/256 are quantized then they are restored exactly") {
+	for (auto dtype : { uint8, int8 }) {
+		QuantizationParameters parameters;
+		parameters.channel_sizes = { 256 };
+		parameters.interleaved = false;
+		parameters.scale.resize(1);
+		parameters.zero_point.resize(1);
+		dataset_file::CalculateQuantization(0, 255.0 / 256, dtype, parameters.scale[0], parameters.zero_point[0]);
+
+		vector<float> values(256);
+		for (int i = 0; i < 256; i++) values[i] = i / 256.f;
+		vector<char> buffer(values.size());
+		vector<float> restored(values.size());
+		dataset_file::Quantize(values.data(), buffer.data(), values.size(), dtype, parameters);
+		dataset_file::Dequantize(buffer.data(), restored.data(), values.size(), dtype, parameters);
+
+		REQUIRE(parameters.scale[0] == 1.f / 256);
+		REQUIRE(restored == values);
+	}
+}
+
+TEST_CASE("When interleaved channels are quantized per channel then error is at most half of the channel scale") {
+	QuantizationParameters parameters;
+	parameters.channel_sizes = { 10, 10 };
+	parameters.interleaved = true;
+	parameters.scale.resize(2);
+	parameters.zero_point.resize(2);
+	dataset_file::CalculateQuantization(-1, 1, int8, parameters.scale[0], parameters.zero_point[0]);
+	dataset_file::CalculateQuantization(0, 100, int8, parameters.scale[1], parameters.zero_point[1]);
+
+	vector<float> values(20);
+	for (size_t i = 0; i < 10; i++) {
+		values[2 * i] = -1 + 0.2f * i;
+		values[2 * i + 1] = 10.f * i;
+	}
+	vector<char> buffer(values.size());
+	vector<float> restored(values.size());
+	dataset_file::Quantize(values.data(), buffer.data(), values.size(), int8, parameters);
+	dataset_file::Dequantize(buffer.data(), restored.data(), values.size(), int8, parameters);
+
+	for (size_t i = 0; i < values.size(); i++) REQUIRE(fabs(restored[i] - values[i]) <= parameters.scale[i % 2] / 2 + 1e-6);
+}
+
+TEST_CASE("When quantization parameters are corrupted then ReadQuantization() throws invalid argument error") {
+	for (int32_t channel_size : { 0, -5 }) {
+		QuantizationParameters parameters;
+		parameters.channel_sizes = { channel_size };
+		parameters.interleaved = false;
+		parameters.scale = { 1.f };
+		parameters.zero_point = { 0 };
+		stringstream stream;
+		dataset_file::WriteQuantization(stream, parameters);
+		REQUIRE_THROWS_AS(dataset_file::ReadQuantization(stream), invalid_argument);
+	}
+
+	const int32_t header[2] = { 1000, 0 };
+	stringstream truncated(string(reinterpret_cast<const char*>(header), sizeof(header)));
+	REQUIRE_THROWS_AS(dataset_file::ReadQuantization(truncated), invalid_argument);
+}
+
+TEST_CASE("When channel sizes do not match the record size then Dequantize() throws before writing") {
+	QuantizationParameters parameters;
+	parameters.channel_sizes = { 1000 };
+	parameters.interleaved = false;
+	parameters.scale = { 1.f };
+	parameters.zero_point = { 0 };
+
+	vector<char> buffer(1000);
+	vector<float> restored(10, 7.f);
+	REQUIRE_THROWS_AS(dataset_file::Dequantize(buffer.data(), restored.data(), restored.size(), uint8, parameters), invalid_argument);
+	REQUIRE(restored == vector<float>(10, 7.f));
+}
+
+TEST_CASE("ShardPath() should insert the shard number before the extension") {
+	REQUIRE(dataset_file::ShardPath("data.bin", 3, 8) == "data-00003-of-00008.bin");
+	REQUIRE(dataset_file::ShardPath("../out.v2/data", 0, 2) == "../out.v2/data-00000-of-00002");
+}
+
+TEST_CASE("When shard index does not match its header then ReadShardIndex() throws invalid argument error") {
+	dataset_file::WriteShardIndex("shard_index_test.index", { { "a.bin", 3 }, { "b.bin", 2 } });
+	const auto shards = dataset_file::ReadShardIndex("shard_index_test.index");
+	REQUIRE(shards.size() == 2);
+	REQUIRE(shards[1].num_records == 2);
+
+	for (auto index : { "shards 1000000000 records 5\na.bin 3\nb.bin 2\n", "shards 2 records 6\na.bin 3\nb.bin 2\n",
+		"shards 2 records 5\na.bin 3\nb.bin x\n", "shards 2 records 1\na.bin 3\nb.bin -2\n" }) {
+		{
+			ofstream file("shard_index_test.index");
+			file << index;
+		}
+		REQUIRE_THROWS_AS(dataset_file::ReadShardIndex("shard_index_test.index"), invalid_argument);
+	}
+}
@@ -0,0 +1,120 @@
+/**
+* @file dataset_reader_tests.cpp
+* @brief Unit tests for DatasetReader class.
+*/
+
+#include "Catch.h"
+#include "../../image_preprocessing/src/data_loader.h"
+#include "../../image_preprocessing/src/dataset_reader.h"
+#include <cstring>
+using namespace std;
+using namespace cv;
+
+TEST_CASE("DatasetReader should return the saved records of version 1 and version 2 files without copying") {
+	ProcessingConfiguration cfg;
+	cfg.format = CV_LOAD_IMAGE_GRAYSCALE;
+	Image::SetCfg(cfg);
+
+	DataLoader data_loader("../../image_preprocessing/tests/samples/50/", 5, cfg);
+	data_loader.ReadData();
+	OutputConfiguration out_cfg;
+	out_cfg.format_version = 2;
+	data_loader.SaveFormattedData("dataset_reader_v2_test.bin", out_cfg);
+	out_cfg.format_version = 1;
+	data_loader.SaveFormattedData("dataset_reader_v1_test.bin", out_cfg);
+
+	vector<vector<float>> data;
+	vector<int> labels;
+	DataLoader::ReadVector("dataset_reader_v2_test.bin", data, labels);
+
+	for (const string path : { "dataset_reader_v1_test.bin", "dataset_reader_v2_test.bin" }) {
+		DatasetReader reader(path);
+		REQUIRE(reader.GetNumRecords() == 50);
+		REQUIRE(reader.GetDataType() == float32);
+		for (int64_t i = 0; i < reader.GetNumRecords(); i++) {
+			const Mat record = reader.GetRecord(i);
+			REQUIRE(record.type() == CV_32F);
+			REQUIRE(vector<float>(record.ptr<float>(), record.ptr<float>() + record.cols) == data[i]);
+			REQUIRE(reader.GetLabel(i) == labels[i]);
+		}
+	}
+	REQUIRE(DatasetReader("dataset_reader_v2_test.bin").GetVersion() == 2);
+	REQUIRE(DatasetReader("dataset_reader_v1_test.bin").GetVersion() == 1);
+}
+
+TEST_CASE("DatasetReader should decode quantized records") {
+	ProcessingConfiguration cfg;
+	cfg.format = CV_LOAD_IMAGE_GRAYSCALE;
+	Image::SetCfg(cfg);
+
+	DataLoader data_loader("../../image_preprocessing/tests/samples/50/", 5, cfg);
+	data_loader.ReadData();
+	OutputConfiguration out_cfg;
+	out_cfg.dtype = uint8;
+	data_loader.SaveFormattedData("dataset_reader_uint8_test.bin", out_cfg);
+
+	vector<vector<float>> data;
+	vector<int> labels;
+	DataLoader::ReadVector("dataset_reader_uint8_test.bin", data, labels);
+
+	DatasetReader reader("dataset_reader_uint8_test.bin", true);
+	REQUIRE(reader.GetRecord(3).type() == CV_8U);
+	vector<float> decoded(reader.GetRecordSize(3));
+	reader.DecodeRecord(3, decoded.data());
+	REQUIRE(decoded == data[3]);
+}
+
+TEST_CASE("When the file is not a dataset file then DatasetReader throws an exception") {
+	{
+		ofstream file("dataset_reader_invalid_test.bin", ios::binary);
+		const int32_t count = 10;
+		file.write(reinterpret_cast<const char*>(&count), sizeof(count));
+	}
+	REQUIRE_THROWS(DatasetReader("dataset_reader_invalid_test.bin"));
+}
+
+TEST_CASE("When record offsets of a version 2 file decrease then DatasetReader throws an exception") {
+	{
+		DatasetHeader header = {};
+		memcpy(header.magic, dataset_file::dataset_magic, sizeof(header.magic));
+		header.version = dataset_file::format_version;
+		header.num_records = 2;
+		header.dtype = float32;
+		header.label_type = dataset_file::label_int32;
+		header.labels_offset = 64;
+		header.data_offset = 128;
+		header.offsets_offset = 192;
+		const int32_t labels[2] = { 0, 1 };
+		const float values[16] = {};
+		const int64_t offsets[3] = { 0, 12, 8 };
+
+		ofstream file("dataset_reader_offsets_test.bin", ios::binary);
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.write(reinterpret_cast<const char*>(labels), sizeof(labels));
+		file.write(string(64 - sizeof(labels), '\0').data(), 64 - sizeof(labels));
+		file.write(reinterpret_cast<const char*>(values), sizeof(values));
+		file.write(reinterpret_cast<const char*>(offsets), sizeof(offsets));
+	}
+	REQUIRE_THROWS_AS(DatasetReader("dataset_reader_offsets_test.bin"), invalid_argument);
+}
+
+TEST_CASE("When quantization channels do not match the record size then DatasetReader throws an exception") {
+	ProcessingConfiguration cfg;
+	cfg.format = CV_LOAD_IMAGE_GRAYSCALE;
+	Image::SetCfg(cfg);
+
+	DataLoader data_loader("../../image_preprocessing/tests/samples/50/", 5, cfg);
+	data_loader.ReadData();
+	OutputConfiguration out_cfg;
+	out_cfg.dtype = uint8;
+	out_cfg.format_version = 1;
+	data_loader.SaveFormattedData("dataset_reader_channels_test.bin", out_cfg);
+	{
+		// extended header: marker, data type, number of channels, interleaved flag, size of the first channel
+		fstream file("dataset_reader_channels_test.bin", ios::binary | ios::in | ios::out);
+		const int32_t channel_size = 1 << 20;
+		file.seekp(4 * sizeof(int32_t));
+		file.write(reinterpret_cast<const char*>(&channel_size), sizeof(channel_size));
+	}
+	REQUIRE_THROWS_AS(DatasetReader("dataset_reader_channels_test.bin"), invalid_argument);
+}
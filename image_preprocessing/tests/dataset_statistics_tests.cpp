@@ -0,0 +1,92 @@
+/**
+* @file dataset_statistics_tests.cpp
+* @brief Unit tests for dataset statistics.
+*/
+
+#include "Catch.h"
+#include "../../image_preprocessing/src/dataset_statistics.h"
+#include <random>
+#include <cmath>
+#include <fstream>
+using namespace std;
+
+TEST_CASE("When partial accumulators are merged then statistics are the same as accumulated in one pass") {
+	default_random_engine generator;
+	uniform_real_distribution<float> distribution(0.f, 1.f);
+	vector<vector<float>> samples(20, vector<float>(12));
+	for (auto& sample : samples) for (auto& value : sample) value = distribution(generator);
+
+	StatisticsAccumulator single({ 8, 2, 2 });
+	StatisticsAccumulator first_half({ 8, 2, 2 });
+	StatisticsAccumulator second_half({ 8, 2, 2 });
+	for (size_t i = 0; i < samples.size(); i++) {
+		single.Add(samples[i]);
+		if (i < 7) first_half.Add(samples[i]);
+		else second_half.Add(samples[i]);
+	}
+	first_half.Merge(second_half);
+
+	auto expected = single.Finish();
+	auto merged = first_half.Finish();
+
+	REQUIRE(merged.count == 20);
+	for (size_t i = 0; i < expected.mean.size(); i++) REQUIRE(merged.mean[i] == Approx(expected.mean[i]));
+	for (size_t c = 0; c < 3; c++) {
+		REQUIRE(merged.channel_mean[c] == Approx(expected.channel_mean[c]));
+		REQUIRE(merged.channel_std[c] == Approx(expected.channel_std[c]));
+	}
+}
+
+TEST_CASE("When data is normalized with channel statistics then every channel has zero mean and unit std") {
+	vector<float> sample = { 0.1f, 0.2f, 0.3f, 0.6f, 0.5f, 0.9f };
+	StatisticsAccumulator accumulator({ 4, 2 });
+	accumulator.Add(sample);
+	auto statistics = accumulator.Finish();
+
+	statistics.Normalize(sample, channel_mean_std);
+
+	REQUIRE(fabs(sample[0] + sample[1] + sample[2] + sample[3]) < 1e-5);
+	REQUIRE(sample[4] == Approx(-1));
+	REQUIRE(sample[5] == Approx(1));
+}
+
+TEST_CASE("When statistics are saved and loaded then they are unchanged") {
+	StatisticsAccumulator accumulator({ 3 });
+	accumulator.Add({ 0.1f, 0.5f, 0.9f });
+	accumulator.Add({ 0.3f, 0.5f, 0.7f });
+	auto statistics = accumulator.Finish();
+
+	statistics.Save("statistics_test.stats");
+	auto loaded = DatasetStatistics::Load("statistics_test.stats");
+
+	REQUIRE(loaded.count == 2);
+	REQUIRE(loaded.channel_sizes == statistics.channel_sizes);
+	REQUIRE(loaded.mean == statistics.mean);
+	REQUIRE(loaded.channel_std[0] == statistics.channel_std[0]);
+}
+
+TEST_CASE("When mean image size does not match the data then Normalize() throws an invalid_argument exception") {
+	StatisticsAccumulator accumulator({ 3 });
+	accumulator.Add({ 0.1f, 0.5f, 0.9f });
+	auto statistics = accumulator.Finish();
+	vector<float> data(4);
+
+	REQUIRE_THROWS_AS(statistics.Normalize(data, mean_image), invalid_argument);
+}
+
+TEST_CASE("When statistics file is corrupted then Load() throws an invalid_argument exception before allocating") {
+	StatisticsAccumulator accumulator({ 3 });
+	accumulator.Add({ 0.1f, 0.5f, 0.9f });
+	accumulator.Finish().Save("statistics_corrupted_test.stats");
+
+	// header: magic, version, number of channels, channel sizes
+	for (auto field : { make_pair(8, 0), make_pair(8, 1 << 30), make_pair(12, -3), make_pair(12, 1 << 28) }) {
+		{
+			fstream file("statistics_corrupted_test.stats", ios::binary | ios::in | ios::out);
+			file.seekp(field.first);
+			file.write(reinterpret_cast<const char*>(&field.second), sizeof(int));
+		}
+		REQUIRE_THROWS_AS(DatasetStatistics::Load("statistics_corrupted_test.stats"), invalid_argument);
+		accumulator.Finish().Save("statistics_corrupted_test.stats");
+	}
+}
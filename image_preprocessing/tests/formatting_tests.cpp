@@ -0,0 +1,59 @@
+/**
+* @file formatting_tests.cpp
+* @brief Unit tests for formatting functions.
+*/
+
+#include "Catch.h"
+#include "../../image_preprocessing/src/formatting.h"
+using namespace std;
+using namespace cv;
+
+TEST_CASE("ConvertPlane() should give the same result as conversion to float and division by 256") {
+	Mat test(7, 37, CV_8U);
+	randu(test, 0, 256);
+	Mat expected;
+	test.convertTo(expected, CV_32F, 1.0 / 256);
+
+	vector<float> out(test.total());
+	formatting::ConvertPlane(test, out.data());
+
+	for (size_t i = 0; i < out.size(); i++) REQUIRE(out[i] == expected.at<float>(static_cast<int>(i)));
+}
+
+TEST_CASE("When planar layout is chosen then formatted color image has decimated chrominances") {
+	Mat test_color = imread("../../image_preprocessing/tests/samples/1.jpg", CV_LOAD_IMAGE_COLOR);
+	auto yuv_image = preprocessing::ConvertToYuv(test_color);
+
+	vector<float> out;
+	auto channel_sizes = formatting::FormatPlanes(yuv_image.luminance, &yuv_image.chrominances, planar, out);
+
+	REQUIRE(out.size() == 6144);
+	REQUIRE(channel_sizes == vector<int>({ 4096, 1024, 1024 }));
+}
+
+TEST_CASE("When nhwc layout is chosen then formatted data is nchw data interleaved") {
+	Mat test_color = imread("../../image_preprocessing/tests/samples/1.jpg", CV_LOAD_IMAGE_COLOR);
+	auto yuv_image = preprocessing::ConvertToYuv(test_color);
+
+	vector<float> channel_major, pixel_major;
+	formatting::FormatPlanes(yuv_image.luminance, &yuv_image.chrominances, nchw, channel_major);
+	auto channel_sizes = formatting::FormatPlanes(yuv_image.luminance, &yuv_image.chrominances, nhwc, pixel_major);
+
+	REQUIRE(pixel_major.size() == 3 * 4096);
+	REQUIRE(channel_sizes == vector<int>({ 4096, 4096, 4096 }));
+	for (size_t i = 0; i < 4096; i++) {
+		for (size_t c = 0; c < 3; c++) REQUIRE(pixel_major[3 * i + c] == channel_major[c * 4096 + i]);
+	}
+}
+
+TEST_CASE("ConvertPlane() should scale 16-bit planes by 1/65536") {
+	Mat test(7, 37, CV_16U);
+	randu(test, 0, 65536);
+	Mat expected;
+	test.convertTo(expected, CV_32F, 1.0 / 65536);
+
+	vector<float> out(test.total());
+	formatting::ConvertPlane(test, out.data());
+
+	for (size_t i = 0; i < out.size(); i++) REQUIRE(out[i] == expected.at<float>(static_cast<int>(i)));
+}
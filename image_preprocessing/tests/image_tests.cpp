@@ -86,3 +86,62 @@ TEST_CASE("When trying to set uncorrect configuration then invalid_argument exce
 }
 
 
+TEST_CASE("When chroma processing is enabled then only the chrominance part of formatted data changes") {
+	ProcessingConfiguration cfg;
+	cfg.format = CV_LOAD_IMAGE_COLOR;
+	cfg.filter = true;
+	cfg.filter_types = { median,gaussian,sobel };
+	cfg.negative = true;
+	Image::SetCfg(cfg);
+
+	Image luma_only_img("../../image_preprocessing/tests/samples/1.jpg", 1);
+	auto luma_only = *luma_only_img.ProcesssAndFormatData();
+
+	cfg.chroma = true;
+	Image::SetCfg(cfg);
+
+	Image chroma_img("../../image_preprocessing/tests/samples/1.jpg", 1);
+	auto with_chroma = *chroma_img.ProcesssAndFormatData();
+
+	REQUIRE(with_chroma.size() == 6144);
+	REQUIRE(equal(luma_only.begin(), luma_only.begin() + 4096, with_chroma.begin()));
+	REQUIRE(!equal(luma_only.begin() + 4096, luma_only.end(), with_chroma.begin() + 4096));
+}
+
+TEST_CASE("When negative is folded into formatting then formatted data equals inverted pixel values") {
+	ProcessingConfiguration cfg;
+	cfg.format = CV_LOAD_IMAGE_GRAYSCALE;
+	cfg.negative = true;
+	Image::SetCfg(cfg);
+
+	Image test_img("../../image_preprocessing/tests/samples/1.jpg", 1);
+	auto formatted = *test_img.ProcesssAndFormatData();
+	Mat original = test_img.GetOriginal();
+
+	REQUIRE(formatted.size() == original.total());
+	for (int i = 0; i < original.rows; i++) {
+		for (int j = 0; j < original.cols; j++) {
+			REQUIRE(formatted[i * original.cols + j] == (255 - original.at<uchar>(i, j)) / 256.f);
+		}
+	}
+}
+
+
+TEST_CASE("When color image is used for pca then PcaRow() returns luminance and decimated chrominances") {
+	ProcessingConfiguration cfg;
+	cfg.format = CV_LOAD_IMAGE_COLOR;
+	cfg.layout = nhwc;
+	Image::SetCfg(cfg);
+
+	Image test_img("../../image_preprocessing/tests/samples/1.jpg", 1);
+	vector<int> plane_sizes;
+	Mat row = test_img.PcaRow(&plane_sizes);
+
+	REQUIRE(row.cols == 6144);
+	REQUIRE(plane_sizes == vector<int>({ 4096, 1024, 1024 }));
+
+	cfg.pca_options.input = pca_luma;
+	Image::SetCfg(cfg);
+	REQUIRE(test_img.PcaRow(&plane_sizes).cols == 4096);
+	REQUIRE(plane_sizes == vector<int>({ 4096 }));
+}
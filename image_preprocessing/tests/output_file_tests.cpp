@@ -0,0 +1,57 @@
+/**
+* @file output_file_tests.cpp
+* @brief Unit tests for OutputFile class.
+*/
+
+#include "Catch.h"
+#include "../../image_preprocessing/src/output_file.h"
+#include <fstream>
+#include <iterator>
+#include <algorithm>
+using namespace std;
+
+namespace
+{
+	vector<char> ReadFile(const string& path)
+	{
+		ifstream file(path, ios::binary);
+		return vector<char>(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+	}
+}
+
+TEST_CASE("OutputFile should write the same bytes as written in pieces, with and without the file cache") {
+	vector<char> expected;
+	for (int i = 0; i < 50000; i++) expected.push_back(static_cast<char>(i * 7 % 251));
+
+	for (bool direct : { false, true }) {
+		OutputFile file("output_file_test.bin", direct, 4096);
+		size_t offset = 0;
+		for (size_t piece = 1; offset < expected.size(); piece = piece * 3 % 9001 + 1) {
+			const size_t size = min(piece, expected.size() - offset);
+			file.Write(expected.data() + offset, size);
+			offset += size;
+		}
+		REQUIRE(file.GetPosition() == static_cast<int64_t>(expected.size()));
+		file.Close();
+		REQUIRE(ReadFile("output_file_test.bin") == expected);
+	}
+}
+
+TEST_CASE("OutputFile should pad with zeros and apply rewrites when closed") {
+	OutputFile file("output_file_rewrite_test.bin", true, 4096);
+	const char header[4] = { 'a', 'b', 'c', 'd' };
+	const char placeholder[4] = {};
+	file.Write(placeholder, sizeof(placeholder));
+	REQUIRE(file.Pad(64) == 64);
+	REQUIRE(file.Pad(64) == 64);
+	file.Write(header, 3);
+	file.Rewrite(0, header, sizeof(header));
+	REQUIRE_THROWS(file.Rewrite(64, header, sizeof(header)));
+	file.Close();
+
+	const vector<char> data = ReadFile("output_file_rewrite_test.bin");
+	REQUIRE(data.size() == 67);
+	REQUIRE(equal(header, header + 4, data.begin()));
+	REQUIRE(count(data.begin() + 4, data.begin() + 64, 0) == 60);
+	REQUIRE(equal(header, header + 3, data.begin() + 64));
+}
@@ -0,0 +1,314 @@
+/**
+* @file pca_engine_tests.cpp
+* @brief Unit tests for incremental pca.
+*/
+
+#include "Catch.h"
+#include "../../image_preprocessing/src/pca_engine.h"
+#include "../../image_preprocessing/src/mapped_file.h"
+#include <cmath>
+#include <fstream>
+#include <set>
+#include <algorithm>
+using namespace std;
+using namespace cv;
+
+namespace
+{
+	/**
+	 * Random rows with decreasing variance of consecutive dimensions (well separated eigenvalues).
+	 */
+	Mat RandomData(int rows, int cols)
+	{
+		Mat data(rows, cols, CV_32F);
+		randn(data, 0, 1);
+		for (int j = 0; j < cols; j++) data.col(j) *= (cols - j);
+		data += 3;
+		return data;
+	}
+}
+
+TEST_CASE("Incremental pca should give the same components as cv::PCA") {
+	Mat data = RandomData(200, 12);
+	CovarianceAccumulator accumulator(12, 16);
+	for (int i = 0; i < data.rows; i++) accumulator.Add(data.row(i));
+
+	PCA incremental = accumulator.Finish(4);
+	PCA expected(data, Mat(), PCA::DATA_AS_ROW, 4);
+
+	REQUIRE(incremental.eigenvectors.rows == 4);
+	for (int j = 0; j < 12; j++) REQUIRE(incremental.mean.at<float>(j) == Approx(expected.mean.at<float>(j)));
+	for (int i = 0; i < 4; i++) {
+		REQUIRE(incremental.eigenvalues.at<float>(i) == Approx(expected.eigenvalues.at<float>(i)).epsilon(1e-3));
+		// eigenvectors are equal up to the sign
+		REQUIRE(fabs(incremental.eigenvectors.row(i).dot(expected.eigenvectors.row(i))) == Approx(1).epsilon(1e-3));
+	}
+}
+
+TEST_CASE("When partial covariance accumulators are merged then pca is the same as accumulated in one pass") {
+	Mat data = RandomData(50, 6);
+	CovarianceAccumulator single(6, 8);
+	CovarianceAccumulator first_part(6, 8);
+	CovarianceAccumulator second_part(6, 8);
+	for (int i = 0; i < data.rows; i++) {
+		single.Add(data.row(i));
+		if (i < 13) first_part.Add(data.row(i));
+		else second_part.Add(data.row(i));
+	}
+	first_part.Merge(second_part);
+
+	PCA expected = single.Finish(0);
+	PCA merged = first_part.Finish(0);
+
+	REQUIRE(first_part.GetCount() == 50);
+	for (int i = 0; i < 6; i++) REQUIRE(merged.eigenvalues.at<float>(i) == Approx(expected.eigenvalues.at<float>(i)));
+}
+
+TEST_CASE("Randomized pca should give the same leading components as the covariance solver") {
+	Mat data = RandomData(300, 40);
+	const auto rows = [&data](int i) { return data.row(i); };
+
+	PCA expected = pca_engine::FitCovariance(data.rows, rows, 5);
+	PcaOptions options;
+	options.components = 5;
+	PcaReport report;
+	PCA randomized = pca_engine::FitRandomized(data.rows, rows, options, &report);
+
+	REQUIRE(randomized.eigenvectors.rows == 5);
+	REQUIRE(randomized.eigenvectors.cols == 40);
+	for (int i = 0; i < 5; i++) {
+		REQUIRE(randomized.eigenvalues.at<float>(i) == Approx(expected.eigenvalues.at<float>(i)).epsilon(1e-2));
+		REQUIRE(fabs(randomized.eigenvectors.row(i).dot(expected.eigenvectors.row(i))) == Approx(1).epsilon(1e-2));
+	}
+	PCA all_components = pca_engine::FitCovariance(data.rows, rows, 0);
+	REQUIRE(report.captured_variance == Approx(sum(expected.eigenvalues)[0] / sum(all_components.eigenvalues)[0]).epsilon(1e-2));
+}
+
+TEST_CASE("Gram solver should give the same components as the covariance solver") {
+	Mat data = RandomData(30, 80);
+	const auto rows = [&data](int i) { return data.row(i); };
+
+	PCA expected = pca_engine::FitCovariance(data.rows, rows, 6);
+	// memory budget smaller than the data - gram matrix computed in several tiles
+	PCA gram = pca_engine::FitGram(data.rows, rows, 6, 0, 30 * 30 * 8 + 7 * 80 * 4);
+
+	REQUIRE(gram.eigenvectors.rows == 6);
+	for (int i = 0; i < 6; i++) {
+		REQUIRE(gram.eigenvalues.at<float>(i) == Approx(expected.eigenvalues.at<float>(i)).epsilon(1e-3));
+		REQUIRE(fabs(gram.eigenvectors.row(i).dot(expected.eigenvectors.row(i))) == Approx(1).epsilon(1e-3));
+	}
+}
+
+TEST_CASE("Automatic solver selection should choose the cheapest solver for the data size") {
+	PcaOptions options;
+	string reason;
+
+	options.components = 0;
+	options.retained_variance = 0.95;
+	REQUIRE(pca_engine::SelectSolver(100000, 256, options, reason) == pca_covariance);
+	REQUIRE(pca_engine::SelectSolver(1000, 65536, options, reason) == pca_gram);
+	REQUIRE(pca_engine::SelectSolver(1000000, 65536, options, reason) == pca_randomized);
+	REQUIRE_FALSE(reason.empty());
+
+	options.components = 100;
+	options.retained_variance = 0;
+	REQUIRE(pca_engine::SelectSolver(100000, 65536, options, reason) == pca_randomized);
+	REQUIRE(pca_engine::SelectSolver(100000, 256, options, reason) == pca_covariance);
+
+	options.solver = pca_gram;
+	REQUIRE(pca_engine::SelectSolver(100000, 256, options, reason) == pca_gram);
+}
+
+TEST_CASE("When retained variance is chosen then the smallest sufficient number of components is kept") {
+	Mat eigenvalues = (Mat_<double>(4, 1) << 6, 2, 1, 1);
+
+	REQUIRE(pca_engine::ComponentsForVariance(eigenvalues, 0.6) == 1);
+	REQUIRE(pca_engine::ComponentsForVariance(eigenvalues, 0.8) == 2);
+	REQUIRE(pca_engine::ComponentsForVariance(eigenvalues, 1.0) == 4);
+}
+
+TEST_CASE("When row of a different size is added to CovarianceAccumulator then throw invalid argument error") {
+	CovarianceAccumulator accumulator(6);
+	REQUIRE_THROWS_AS(accumulator.Add(Mat::zeros(1, 5, CV_32F)), invalid_argument);
+}
+
+TEST_CASE("Saved pca model should be loaded with the same mean, eigenvalues and eigenvectors") {
+	Mat data = RandomData(40, 20);
+	PCA pca(data, Mat(), PCA::DATA_AS_ROW, 5);
+	pca_engine::SaveModel("pca_model_test.pca", pca);
+
+	MappedFile file("pca_model_test.pca");
+	PCA loaded = pca_engine::LoadModel(file);
+
+	REQUIRE(reinterpret_cast<uintptr_t>(loaded.eigenvectors.ptr(1)) % 64 == 0);
+	REQUIRE(countNonZero(loaded.mean != pca.mean) == 0);
+	REQUIRE(countNonZero(loaded.eigenvalues != pca.eigenvalues) == 0);
+	REQUIRE(countNonZero(loaded.eigenvectors != pca.eigenvectors) == 0);
+
+	Mat projection = loaded.project(data.row(3));
+	Mat expected = pca.project(data.row(3));
+	REQUIRE(norm(projection, expected, NORM_INF) < 1e-5);
+}
+
+TEST_CASE("When file is not a pca model then LoadModel() throws invalid argument error") {
+	ofstream("not_pca_model_test.pca", ios::binary) << string(100, 'x');
+	MappedFile file("not_pca_model_test.pca");
+	REQUIRE_THROWS_AS(pca_engine::LoadModel(file), invalid_argument);
+}
+
+TEST_CASE("When an array of the pca model is outside of the file then LoadModel() throws invalid argument error") {
+	Mat data = RandomData(40, 20);
+	PCA pca(data, Mat(), PCA::DATA_AS_ROW, 5);
+	for (int64_t mean_offset : { int64_t(-64), int64_t(1) << 40 }) {
+		pca_engine::SaveModel("corrupted_pca_model_test.pca", pca);
+		{
+			fstream model("corrupted_pca_model_test.pca", ios::binary | ios::in | ios::out);
+			model.seekp(16);
+			model.write(reinterpret_cast<const char*>(&mean_offset), sizeof(mean_offset));
+		}
+		MappedFile file("corrupted_pca_model_test.pca");
+		REQUIRE_THROWS_AS(pca_engine::LoadModel(file), invalid_argument);
+	}
+}
+
+TEST_CASE("Batched projection should give the same result as cv::PCA::project") {
+	Mat data = RandomData(50, 30);
+	PCA pca(data, Mat(), PCA::DATA_AS_ROW, 8);
+
+	Mat projections;
+	pca_engine::Project(pca, data, projections);
+
+	REQUIRE(projections.rows == 50);
+	REQUIRE(projections.cols == 8);
+	REQUIRE(norm(projections, pca.project(data), NORM_INF) < 1e-3);
+}
+
+TEST_CASE("Projection of rows far from the origin should keep float precision") {
+	Mat data = RandomData(50, 30) + 10000;
+	PCA pca(data, Mat(), PCA::DATA_AS_ROW, 8);
+
+	Mat projections;
+	pca_engine::Project(pca, data, projections);
+
+	Mat data_64f, mean_64f, eigenvectors_64f, expected;
+	data.convertTo(data_64f, CV_64F);
+	pca.mean.convertTo(mean_64f, CV_64F);
+	pca.eigenvectors.convertTo(eigenvectors_64f, CV_64F);
+	for (int i = 0; i < data_64f.rows; i++) data_64f.row(i) -= mean_64f;
+	gemm(data_64f, eigenvectors_64f, 1, noArray(), 0, expected, GEMM_2_T);
+	expected.convertTo(expected, CV_32F);
+	REQUIRE(norm(projections, expected, NORM_INF) < 1e-2);
+}
+
+TEST_CASE("Stratified sample should keep the proportions of labels") {
+	vector<int> labels;
+	for (int i = 0; i < 90; i++) labels.push_back(i < 60 ? 0 : 1);
+
+	vector<int> order = pca_engine::SampleRows(labels, 30, true, 7);
+
+	REQUIRE(order.size() == 90);
+	REQUIRE(set<int>(order.begin(), order.end()).size() == 90);
+	REQUIRE(count_if(order.begin(), order.begin() + 30, [&labels](int i) { return labels[i] == 0; }) == 20);
+	REQUIRE(pca_engine::SampleRows(labels, 30, true, 7) == order);
+}
+
+TEST_CASE("Pca fitted on a sample should capture similar variance of the held-out rows") {
+	Mat data = RandomData(400, 20);
+	const auto rows = [&data](int i) { return data.row(i); };
+	PCA pca = pca_engine::FitCovariance(300, rows, 5);
+
+	const double held_out = pca_engine::CapturedVariance(pca, 100, [&data](int i) { return data.row(300 + i); });
+	const double sample = pca_engine::CapturedVariance(pca, 300, rows);
+
+	REQUIRE(sample == Approx(sum(pca.eigenvalues)[0] / sum(pca_engine::FitCovariance(300, rows, 0).eigenvalues)[0]).epsilon(1e-3));
+	REQUIRE(fabs(held_out - sample) < 0.05);
+}
+
+TEST_CASE("Per-plane pca should combine separate pca of every plane sorted by eigenvalue") {
+	Mat data = RandomData(200, 16);
+	const auto rows = [&data](int i) { return data.row(i); };
+	PcaOptions options;
+	options.solver = pca_covariance;
+	options.components = 8;
+
+	PcaReport report;
+	PCA per_plane = pca_engine::FitPerPlane(data.rows, rows, { 8, 4, 4 }, options, &report);
+	PCA second_plane = pca_engine::FitCovariance(data.rows, [&data](int i) { return data.row(i).colRange(8, 12); }, 2);
+
+	REQUIRE(per_plane.eigenvectors.rows == 8);
+	REQUIRE(per_plane.eigenvectors.cols == 16);
+	REQUIRE(report.solver == pca_auto);
+	REQUIRE(report.reason.find("plane 2: covariance") != string::npos);
+	REQUIRE(norm(per_plane.mean.colRange(8, 12), second_plane.mean, NORM_INF) < 1e-4);
+	for (int i = 1; i < per_plane.eigenvectors.rows; i++) {
+		REQUIRE(per_plane.eigenvalues.at<float>(i - 1) >= per_plane.eigenvalues.at<float>(i));
+	}
+	// every component is non-zero only in the columns of one plane, components of the second plane are found by eigenvalue
+	const vector<Range> planes = { Range(0, 8), Range(8, 12), Range(12, 16) };
+	for (int i = 0; i < per_plane.eigenvectors.rows; i++) {
+		int planes_used = 0;
+		for (auto& plane : planes) planes_used += countNonZero(per_plane.eigenvectors.row(i).colRange(plane)) > 0;
+		REQUIRE(planes_used == 1);
+	}
+	for (int j = 0; j < 2; j++) {
+		int found = 0;
+		for (int i = 0; i < per_plane.eigenvectors.rows; i++) {
+			if (countNonZero(per_plane.eigenvectors.row(i).colRange(planes[1])) == 0) continue;
+			if (per_plane.eigenvalues.at<float>(i) != Approx(second_plane.eigenvalues.at<float>(j))) continue;
+			REQUIRE(fabs(per_plane.eigenvectors.row(i).colRange(planes[1]).dot(second_plane.eigenvectors.row(j))) == Approx(1).epsilon(1e-3));
+			found++;
+		}
+		REQUIRE(found == 1);
+	}
+}
+
+TEST_CASE("Pca whitened projections should have unit variance and zca whitened covariance should be identity") {
+	Mat data = RandomData(500, 10);
+	PCA pca(data, Mat(), PCA::DATA_AS_ROW, 10);
+
+	Mat projections, covariance, mean;
+	pca_engine::Project(pca_engine::Whiten(pca, pca_whitening, 0), data, projections);
+	calcCovarMatrix(projections, covariance, mean, COVAR_NORMAL | COVAR_ROWS | COVAR_SCALE, CV_64F);
+	REQUIRE(norm(covariance, Mat::eye(10, 10, CV_64F), NORM_INF) < 1e-3);
+
+	PCA zca = pca_engine::Whiten(pca, zca_whitening, 0);
+	REQUIRE(zca.eigenvectors.rows == 10);
+	pca_engine::Project(zca, data, projections);
+	calcCovarMatrix(projections, covariance, mean, COVAR_NORMAL | COVAR_ROWS | COVAR_SCALE, CV_64F);
+	REQUIRE(norm(covariance, Mat::eye(10, 10, CV_64F), NORM_INF) < 1e-3);
+}
+
+TEST_CASE("Saved zca whitened model should be loaded with its whitening and all the eigenvalues") {
+	Mat data = RandomData(40, 20);
+	PCA zca = pca_engine::Whiten(PCA(data, Mat(), PCA::DATA_AS_ROW, 5), zca_whitening, 1e-3);
+	pca_engine::SaveModel("zca_model_test.pca", zca, zca_whitening, 1e-3);
+
+	MappedFile file("zca_model_test.pca");
+	PcaWhitening whitening = no_whitening;
+	PCA loaded = pca_engine::LoadModel(file, &whitening);
+
+	REQUIRE(whitening == zca_whitening);
+	REQUIRE(loaded.eigenvalues.rows == 5);
+	REQUIRE(loaded.eigenvectors.rows == 20);
+	REQUIRE(countNonZero(loaded.eigenvectors != zca.eigenvectors) == 0);
+}
+
+TEST_CASE("Out of core pca should give the same components as the covariance solver") {
+	Mat data = RandomData(300, 12);
+	const auto rows = [&data](int i) { return data.row(i); };
+
+	PCA expected = pca_engine::FitCovariance(data.rows, rows, 4);
+	PcaOptions options;
+	options.components = 4;
+	// memory budget for the covariance matrices and tiles of 64 rows - several tiles
+	options.memory_budget = 2 * 12 * 12 * 8 + 64 * 12 * 12;
+	PcaReport report;
+	PCA out_of_core = pca_engine::FitOutOfCore(data.rows, rows, options, &report);
+
+	REQUIRE(out_of_core.eigenvectors.rows == 4);
+	REQUIRE(norm(out_of_core.mean, expected.mean, NORM_INF) < 1e-4);
+	for (int i = 0; i < 4; i++) {
+		REQUIRE(out_of_core.eigenvalues.at<float>(i) == Approx(expected.eigenvalues.at<float>(i)).epsilon(1e-4));
+		REQUIRE(fabs(out_of_core.eigenvectors.row(i).dot(expected.eigenvectors.row(i))) == Approx(1).epsilon(1e-4));
+	}
+}
@@ -0,0 +1,40 @@
+/**
+* @file positional_file_tests.cpp
+* @brief Unit tests for PositionalFile class.
+*/
+
+#include "Catch.h"
+#include "../../image_preprocessing/src/positional_file.h"
+#include <fstream>
+#include <iterator>
+#include <thread>
+#include <algorithm>
+using namespace std;
+
+TEST_CASE("PositionalFile should keep records written by many threads in any order at their offsets") {
+	const int num_records = 64;
+	const int record_size = 1000;
+	{
+		PositionalFile file("positional_file_test.bin", 100 + num_records * record_size);
+		vector<thread> threads;
+		for (int t = 0; t < 4; t++) {
+			threads.emplace_back([&file, t]() {
+				for (int i = num_records - 1 - t; i >= 0; i -= 4) {
+					const vector<char> record(record_size, static_cast<char>(i));
+					file.WriteAt(100 + i * static_cast<int64_t>(record_size), record.data(), record.size());
+				}
+			});
+		}
+		for (auto& worker : threads) worker.join();
+		REQUIRE_THROWS(file.WriteAt(file.GetSize() - 1, "ab", 2));
+	}
+
+	ifstream file("positional_file_test.bin", ios::binary);
+	const vector<char> data((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+	REQUIRE(data.size() == 100 + num_records * record_size);
+	REQUIRE(count(data.begin(), data.begin() + 100, 0) == 100);
+	for (int i = 0; i < num_records; i++) {
+		REQUIRE(data[100 + i * record_size] == static_cast<char>(i));
+		REQUIRE(data[100 + (i + 1) * record_size - 1] == static_cast<char>(i));
+	}
+}
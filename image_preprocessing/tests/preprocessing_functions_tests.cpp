@@ -110,4 +110,221 @@ TEST_CASE("ConvertToYuv() should return structure with full-size luminance and 4
 	REQUIRE(test_color.total() == 3 * y_total);
 	REQUIRE(u_total == v_total);
 	REQUIRE(y_total == 4 * v_total);
-}
\ No newline at end of file
+}
+
+TEST_CASE("When image is standardized then its mean is 0 and standard deviation is 1") {
+	Mat test = imread("../../image_preprocessing/tests/samples/1.jpg", CV_LOAD_IMAGE_GRAYSCALE);
+	preprocessing::Standardize(test);
+
+	Scalar mean_value, std_value;
+	meanStdDev(test, mean_value, std_value);
+
+	REQUIRE(test.type() == CV_32F);
+	REQUIRE(fabs(mean_value[0]) < 1e-4);
+	REQUIRE(std_value[0] == Approx(1.0));
+}
+
+TEST_CASE("LocalContrastNormalize() should give the same result as normalization with explicit windows") {
+	Mat test(16, 20, CV_8U);
+	randu(test, 0, 256);
+	const int window_size = 5;
+	const int radius = window_size / 2;
+
+	Mat local_mean(test.size(), CV_32F), local_std(test.size(), CV_32F);
+	for (int y = 0; y < test.rows; y++) {
+		for (int x = 0; x < test.cols; x++) {
+			Rect window(Point(max(0, x - radius), max(0, y - radius)), Point(min(test.cols, x + radius + 1), min(test.rows, y + radius + 1)));
+			Scalar mean_value, std_value;
+			meanStdDev(test(window), mean_value, std_value);
+			local_mean.at<float>(y, x) = static_cast<float>(mean_value[0]);
+			local_std.at<float>(y, x) = static_cast<float>(std_value[0]);
+		}
+	}
+	const float min_std = static_cast<float>(mean(local_std)[0]);
+
+	Mat lcn = test.clone();
+	preprocessing::LocalContrastNormalize(lcn, window_size);
+
+	for (int y = 0; y < test.rows; y++) {
+		for (int x = 0; x < test.cols; x++) {
+			const float expected = (test.at<uchar>(y, x) - local_mean.at<float>(y, x)) / max(local_std.at<float>(y, x), min_std);
+			REQUIRE(fabs(lcn.at<float>(y, x) - expected) < 1e-3);
+		}
+	}
+}
+
+TEST_CASE("When even window size passed to LocalContrastNormalize() then throw invalid argument error") {
+	Mat test = imread("../../image_preprocessing/tests/samples/1.jpg", CV_LOAD_IMAGE_GRAYSCALE);
+	REQUIRE_THROWS_AS(preprocessing::LocalContrastNormalize(test, 4), invalid_argument);
+}
+
+TEST_CASE("When negative is composed twice then ComposeLut() returns identity table") {
+	Mat lut = preprocessing::ComposeLut({ { negative_op, 0, 0 }, { negative_op, 0, 0 } });
+
+	for (int i = 0; i < 256; i++) REQUIRE(lut.at<uchar>(i) == i);
+}
+
+TEST_CASE("Composed look-up table should give the same result as pointwise operations applied one by one") {
+	Mat test = imread("../../image_preprocessing/tests/samples/1.jpg", CV_LOAD_IMAGE_GRAYSCALE);
+	vector<PointwiseOperation> operations = { { gamma_op, 0.5, 0 }, { contrast_op, 0.1, 0.9 }, { negative_op, 0, 0 }, { threshold_op, 0.3, 0 } };
+
+	Mat one_by_one = test.clone();
+	for (auto& operation : operations) preprocessing::ApplyPointwise(one_by_one, { operation });
+
+	Mat composed = test.clone();
+	preprocessing::ApplyLut(composed, preprocessing::ComposeLut(operations));
+
+	REQUIRE(countNonZero(one_by_one != composed) == 0);
+}
+
+TEST_CASE("Negative look-up table should give the same result as ConvertToNegative()") {
+	Mat test = imread("../../image_preprocessing/tests/samples/1.jpg", CV_LOAD_IMAGE_GRAYSCALE);
+	Mat negative = test.clone();
+	preprocessing::ConvertToNegative(negative);
+
+	preprocessing::ApplyLut(test, preprocessing::ComposeLut({ { negative_op, 0, 0 } }));
+
+	REQUIRE(countNonZero(test != negative) == 0);
+}
+
+TEST_CASE("Fixed-point negative should give the same result as the 8-bit negative") {
+	Mat test = imread("../../image_preprocessing/tests/samples/1.jpg", CV_LOAD_IMAGE_GRAYSCALE);
+	Mat negative = test.clone();
+	preprocessing::ConvertToNegative(negative);
+	preprocessing::ConvertToFixedPoint(negative);
+
+	preprocessing::ConvertToFixedPoint(test);
+	preprocessing::ConvertToNegative(test);
+
+	REQUIRE(test.type() == CV_16S);
+	REQUIRE(countNonZero(test != negative) == 0);
+}
+
+TEST_CASE("Fixed-point median filter should give the same result as the 8-bit median filter") {
+	Mat test = imread("../../image_preprocessing/tests/samples/1.jpg", CV_LOAD_IMAGE_GRAYSCALE);
+	Mat filtered = test.clone();
+	preprocessing::Filter(filtered, median);
+	preprocessing::ConvertToFixedPoint(filtered);
+
+	preprocessing::ConvertToFixedPoint(test);
+	preprocessing::Filter(test, median);
+
+	REQUIRE(countNonZero(test != filtered) == 0);
+}
+
+TEST_CASE("Fixed-point sobel filter should differ from the 8-bit sobel filter only by rounding") {
+	Mat test = imread("../../image_preprocessing/tests/samples/1.jpg", CV_LOAD_IMAGE_GRAYSCALE);
+	Mat filtered = test.clone();
+	preprocessing::Filter(filtered, sobel);
+
+	preprocessing::ConvertToFixedPoint(test);
+	preprocessing::Filter(test, sobel);
+
+	Mat fixed_point_8bit;
+	test.convertTo(fixed_point_8bit, CV_32F, 1.0 / (1 << preprocessing::fixed_point_bits));
+	Mat difference = abs(fixed_point_8bit - Mat_<float>(filtered));
+	double max_difference;
+	minMaxLoc(difference, nullptr, &max_difference);
+	REQUIRE(max_difference <= 1.0);
+}
+
+TEST_CASE("When mean is subtracted from a fixed-point image then negative values are kept") {
+	Mat test = imread("../../image_preprocessing/tests/samples/1.jpg", CV_LOAD_IMAGE_GRAYSCALE);
+	preprocessing::ConvertToFixedPoint(test);
+	preprocessing::SubtractMean(test);
+
+	double min_value;
+	minMaxLoc(test, &min_value);
+	REQUIRE(min_value < 0);
+	REQUIRE(fabs(mean(test)[0]) < 1);
+}
+
+TEST_CASE("When a float Mat passed to ConvertToFixedPoint() then throw invalid argument error") {
+	Mat test(4, 4, CV_32F, Scalar(0.5));
+	REQUIRE_THROWS_AS(preprocessing::ConvertToFixedPoint(test), invalid_argument);
+}
+
+TEST_CASE("16-bit negative should give the same result as the 8-bit negative scaled to 16 bits") {
+	Mat test = imread("../../image_preprocessing/tests/samples/1.jpg", CV_LOAD_IMAGE_GRAYSCALE);
+	Mat negative = test.clone();
+	preprocessing::ConvertToNegative(negative);
+	negative.convertTo(negative, CV_16U, 257);
+
+	test.convertTo(test, CV_16U, 257);
+	preprocessing::ConvertToNegative(test);
+
+	REQUIRE(test.type() == CV_16U);
+	REQUIRE(countNonZero(test != negative) == 0);
+}
+
+TEST_CASE("When 16-bit Mat passed to Filter() then it stays 16-bit") {
+	Mat test = imread("../../image_preprocessing/tests/samples/1.jpg", CV_LOAD_IMAGE_GRAYSCALE);
+	test.convertTo(test, CV_16U, 257);
+
+	for (auto type : { sobel, median, gaussian }) {
+		Mat filtered = test.clone();
+		preprocessing::Filter(filtered, type);
+		REQUIRE(filtered.type() == CV_16U);
+		REQUIRE(filtered.size() == test.size());
+	}
+}
+
+TEST_CASE("16-bit sobel filter should give the 8-bit result scaled to 16 bits") {
+	Mat test = imread("../../image_preprocessing/tests/samples/1.jpg", CV_LOAD_IMAGE_GRAYSCALE);
+	Mat filtered = test.clone();
+	preprocessing::Filter(filtered, sobel);
+
+	test.convertTo(test, CV_16U, 257);
+	preprocessing::Filter(test, sobel);
+
+	Mat difference = abs(Mat_<float>(test) / 257 - Mat_<float>(filtered));
+	double max_difference;
+	minMaxLoc(difference, nullptr, &max_difference);
+	REQUIRE(max_difference <= 1.0);
+}
+
+TEST_CASE("Pointwise operations on 16-bit Mat should keep the 16-bit type") {
+	Mat test(4, 4, CV_16U, Scalar(65535));
+	preprocessing::ApplyPointwise(test, { { contrast_op, 0, 0.5 } });
+
+	REQUIRE(test.type() == CV_16U);
+	REQUIRE(test.at<ushort>(0, 0) == 65535);
+}
+
+TEST_CASE("Fixed-point look-up table should give the same result as pointwise operations applied pixel by pixel") {
+	Mat test = imread("../../image_preprocessing/tests/samples/1.jpg", CV_LOAD_IMAGE_GRAYSCALE);
+	preprocessing::ConvertToFixedPoint(test);
+	vector<PointwiseOperation> operations = { { gamma_op, 0.5, 0 }, { contrast_op, 0.1, 0.9 } };
+
+	Mat expected = test.clone();
+	for (int i = 0; i < expected.rows; i++) {
+		for (int j = 0; j < expected.cols; j++) {
+			double value = static_cast<double>(expected.at<short>(i, j)) / preprocessing::fixed_point_max;
+			for (auto& operation : operations) value = preprocessing::ApplyPointwise(value, operation);
+			expected.at<short>(i, j) = saturate_cast<short>(value * preprocessing::fixed_point_max);
+		}
+	}
+	preprocessing::ApplyPointwise(test, operations);
+
+	REQUIRE(test.type() == CV_16S);
+	REQUIRE(countNonZero(test != expected) == 0);
+}
+
+TEST_CASE("16-bit look-up table should give the same result as pointwise operations applied pixel by pixel") {
+	Mat test = imread("../../image_preprocessing/tests/samples/1.jpg", CV_LOAD_IMAGE_GRAYSCALE);
+	test.convertTo(test, CV_16U, 257);
+	vector<PointwiseOperation> operations = { { negative_op, 0, 0 }, { gamma_op, 2.2, 0 }, { clamp_op, 0.2, 0.8 } };
+
+	Mat expected = test.clone();
+	for (int i = 0; i < expected.rows; i++) {
+		for (int j = 0; j < expected.cols; j++) {
+			double value = static_cast<double>(expected.at<ushort>(i, j)) / 65535;
+			for (auto& operation : operations) value = preprocessing::ApplyPointwise(value, operation);
+			expected.at<ushort>(i, j) = saturate_cast<ushort>(value * 65535);
+		}
+	}
+	preprocessing::ApplyLut(test, preprocessing::ComposeLut16(operations, CV_16U));
+
+	REQUIRE(test.type() == CV_16U);
+	REQUIRE(countNonZero(test != expected) == 0);
+}
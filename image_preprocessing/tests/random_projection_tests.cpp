@@ -0,0 +1,56 @@
+/**
+* @file random_projection_tests.cpp
+* @brief Unit tests for sparse random projection.
+*/
+
+#include "Catch.h"
+#include "../../image_preprocessing/src/random_projection.h"
+#include <cmath>
+using namespace std;
+using namespace cv;
+
+TEST_CASE("Sparse random projection should be the same for the same seed and different for another seed") {
+	Mat rows(5, 100, CV_32F);
+	randu(rows, 0, 1);
+
+	Mat first, second, other;
+	SparseRandomProjection(100, 20, 42).Project(rows, first);
+	SparseRandomProjection(100, 20, 42).Project(rows, second);
+	SparseRandomProjection(100, 20, 43).Project(rows, other);
+
+	REQUIRE(first.rows == 5);
+	REQUIRE(first.cols == 20);
+	REQUIRE(countNonZero(first != second) == 0);
+	REQUIRE(countNonZero(first != other) > 0);
+}
+
+TEST_CASE("Batched sparse random projection should be equal to the projection of every row") {
+	Mat rows(13, 64, CV_32F);
+	randu(rows, -1, 1);
+	SparseRandomProjection projection(64, 10, 7);
+
+	Mat batch;
+	projection.Project(rows, batch);
+	for (int i = 0; i < rows.rows; i++) {
+		Mat single;
+		projection.Project(rows.row(i), single);
+		REQUIRE(norm(single, batch.row(i), NORM_INF) < 1e-5);
+	}
+}
+
+TEST_CASE("Sparse random projection should approximately preserve squared norms") {
+	Mat rows(50, 1024, CV_32F);
+	randn(rows, 0, 1);
+	SparseRandomProjection projection(1024, 512, 1);
+
+	Mat projections;
+	projection.Project(rows, projections);
+	for (int i = 0; i < rows.rows; i++) {
+		REQUIRE(fabs(projections.row(i).dot(projections.row(i)) / rows.row(i).dot(rows.row(i)) - 1) < 0.3);
+	}
+}
+
+TEST_CASE("When rows have a different size than the projection then throw invalid argument error") {
+	Mat projections;
+	REQUIRE_THROWS_AS(SparseRandomProjection(10, 2, 0).Project(Mat::zeros(1, 9, CV_32F), projections), invalid_argument);
+}